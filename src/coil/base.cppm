@@ -4,6 +4,7 @@ module;
 #include <concepts>
 #include <sstream>
 #include <string_view>
+#include <type_traits>
 #include <vector>
 #include <array>
 #include <version>
@@ -21,10 +22,15 @@ export module coil.core.base;
 export namespace Coil
 {
   // Book is a container for objects to remove them later.
+  // Objects are allocated from chunks, which grow geometrically.
+  // Trivially destructible objects are stored without header.
+  // Large objects get dedicated allocations, still freed by the book.
   class Book
   {
   public:
     Book() = default;
+    explicit Book(size_t chunkSize)
+    : _initialChunkSize(std::max(chunkSize, _MinChunkSize)), _nextChunkSize(_initialChunkSize) {}
     Book(Book const&) = delete;
     Book(Book&& other) noexcept
     {
@@ -39,8 +45,11 @@ export namespace Coil
     Book& operator=(Book&& other) noexcept
     {
       std::swap(_lastChunk, other._lastChunk);
+      std::swap(_lastChunkSize, other._lastChunkSize);
       std::swap(_lastChunkAllocated, other._lastChunkAllocated);
       std::swap(_lastObjectHeader, other._lastObjectHeader);
+      std::swap(_initialChunkSize, other._initialChunkSize);
+      std::swap(_nextChunkSize, other._nextChunkSize);
       return *this;
     }
 
@@ -48,12 +57,15 @@ export namespace Coil
     template <typename T, typename... Args>
     T& Allocate(Args&&... args)
     {
-      static_assert(sizeof(TemplObjectHeader<T>) + sizeof(T) <= _MaxObjectSize, "too big object to allocate in a book");
       static_assert(alignof(T) <= _MaxAlignment, "unsupported object alignment to allocate in a book");
-      return InitObject<T, Args...>(
-        _AllocateFromPool(sizeof(TemplObjectHeader<T>) + sizeof(T)),
-        std::forward<Args>(args)...
-      );
+      // no need to remember trivially destructible objects
+      if constexpr(std::is_trivially_destructible_v<T>)
+        return *new (_AllocateFromPool(sizeof(T))) T(std::forward<Args>(args)...);
+      else
+        return InitObject<T, Args...>(
+          _AllocateFromPool(sizeof(TemplObjectHeader<T>) + sizeof(T)),
+          std::forward<Args>(args)...
+        );
     }
     // Delete all objects.
     void Free()
@@ -61,12 +73,14 @@ export namespace Coil
       while(_lastObjectHeader)
       {
         ObjectHeader* prev = _lastObjectHeader->prev;
-        _lastObjectHeader->~ObjectHeader();
+        _lastObjectHeader->Destroy();
         _lastObjectHeader = prev;
       }
       _lastChunk = nullptr;
+      _lastChunkSize = 0;
       _lastChunkAllocated = 0;
       _lastObjectHeader = nullptr;
+      _nextChunkSize = _initialChunkSize;
     }
 
   private:
@@ -83,7 +97,8 @@ export namespace Coil
     {
       ObjectHeader(ObjectHeader* prev)
       : prev(prev) {}
-      virtual ~ObjectHeader() = default;
+      // destroy object (headers themselves are trivially destructible)
+      virtual void Destroy() = 0;
 
       ObjectHeader* prev;
     };
@@ -97,7 +112,7 @@ export namespace Coil
     {
       TemplObjectHeader(ObjectHeader* prev)
       : ObjectHeader(prev) {}
-      ~TemplObjectHeader()
+      void Destroy() override
       {
         reinterpret_cast<T*>(this + 1)->~T();
       }
@@ -108,33 +123,58 @@ export namespace Coil
     {
       TemplObjectHeader(ObjectHeader* prev)
       : ObjectHeader(prev) {}
-      ~TemplObjectHeader()
+      // chunk frees its own memory, so it must not be a destructor
+      void Destroy() override
       {
         delete [] reinterpret_cast<uint8_t*>(this);
       }
     };
 
+    static constexpr size_t _AlignSize(size_t size)
+    {
+      return (size + _MaxAlignment - 1) & ~(_MaxAlignment - 1);
+    }
+
+    // Allocate chunk of memory, and register it to be freed.
+    uint8_t* _AllocateChunk(size_t size)
+    {
+      uint8_t* chunk = new uint8_t[size];
+      InitObject<_Chunk>(chunk);
+      return chunk;
+    }
+
     void* _AllocateFromPool(size_t size)
     {
-      if(!_lastChunk || _lastChunkAllocated + size > _ChunkSize)
+      size = _AlignSize(size);
+      // large objects get dedicated chunks, so they don't waste space in regular ones
+      if(size > _nextChunkSize / 4)
+        return _AllocateChunk(_ChunkHeaderSize + size) + _ChunkHeaderSize;
+
+      if(!_lastChunk || _lastChunkAllocated + size > _lastChunkSize)
       {
-        _lastChunk = new uint8_t[_ChunkSize];
-        _lastChunkAllocated = sizeof(TemplObjectHeader<_Chunk>);
-        InitObject<_Chunk>(_lastChunk);
+        _lastChunkSize = _nextChunkSize;
+        _nextChunkSize = std::max(std::min(_nextChunkSize * 2, _MaxChunkSize), _initialChunkSize);
+        _lastChunk = _AllocateChunk(_lastChunkSize);
+        _lastChunkAllocated = _ChunkHeaderSize;
       }
       void* data = _lastChunk + _lastChunkAllocated;
-      _lastChunkAllocated += (size + _MaxAlignment - 1) & ~(_MaxAlignment - 1);
+      _lastChunkAllocated += size;
       return data;
     }
 
     void _Register(ObjectHeader* objectHeader);
 
     uint8_t* _lastChunk = nullptr;
+    size_t _lastChunkSize = 0;
     size_t _lastChunkAllocated = 0;
     ObjectHeader* _lastObjectHeader = nullptr;
+    size_t _initialChunkSize = _DefaultChunkSize;
+    size_t _nextChunkSize = _DefaultChunkSize;
 
-    static constexpr size_t _ChunkSize = 0x1000 - 128; // try to (over)estimate heap's overhead
-    static constexpr size_t _MaxObjectSize = _ChunkSize - sizeof(ObjectHeader);
+    static constexpr size_t _ChunkHeaderSize = (sizeof(TemplObjectHeader<_Chunk>) + _MaxAlignment - 1) & ~(_MaxAlignment - 1);
+    static constexpr size_t _DefaultChunkSize = 0x1000 - 128; // try to (over)estimate heap's overhead
+    static constexpr size_t _MinChunkSize = 0x100;
+    static constexpr size_t _MaxChunkSize = 0x100000 - 128;
   };
 
   // Piece of allocated or mapped memory.
@@ -0,0 +1,199 @@
+#include "base.hpp"
+#include "entrypoint.hpp"
+#include <algorithm>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+import coil.core.base;
+import coil.core.tasks.streams;
+import coil.core.tasks.sync;
+import coil.core.tasks;
+
+using namespace Coil;
+
+// benchmarks of task runtime
+// prints results as JSON, to be compared between versions
+class Bencher
+{
+public:
+  Bencher(size_t threadsCount)
+  : _threadsCount(threadsCount) {}
+
+  void Run()
+  {
+    Measure("spawn", 100000, [](uint64_t n) -> Task<void>
+    {
+      std::vector<Task<void>> tasks;
+      tasks.reserve(n);
+      for(uint64_t i = 0; i < n; ++i)
+        tasks.push_back([]() -> Task<void>
+        {
+          co_return;
+        }());
+      co_await WhenAll(tasks);
+    });
+
+    Measure("await_latency", 100000, [](uint64_t n) -> Task<void>
+    {
+      for(uint64_t i = 0; i < n; ++i)
+        co_await []() -> Task<void>
+        {
+          co_return;
+        }();
+    });
+
+    Measure("cv_ping_pong", 10000, [](uint64_t n) -> Task<void>
+    {
+      struct State
+      {
+        std::mutex mutex;
+        ConditionVariable cv;
+        uint64_t turn = 0;
+      };
+      auto player = [](State& state, uint64_t n, uint64_t parity) -> Task<void>
+      {
+        std::unique_lock lock{state.mutex};
+        for(uint64_t i = 0; i < n; ++i)
+        {
+          while(state.turn % 2 != parity)
+            co_await state.cv.Wait(lock);
+          ++state.turn;
+          state.cv.NotifyAll();
+        }
+      };
+      State state;
+      Task<void> ping = player(state, n, 0);
+      Task<void> pong = player(state, n, 1);
+      co_await ping;
+      co_await pong;
+    });
+
+    Measure("semaphore_contention", 100000, [threadsCount = _threadsCount](uint64_t n) -> Task<void>
+    {
+      Semaphore semaphore(1);
+      uint64_t counter = 0;
+      size_t const contendersCount = threadsCount * 2;
+      std::vector<Task<void>> tasks;
+      for(size_t i = 0; i < contendersCount; ++i)
+        tasks.push_back([](Semaphore& semaphore, uint64_t& counter, uint64_t count) -> Task<void>
+        {
+          for(uint64_t j = 0; j < count; ++j)
+          {
+            co_await semaphore.Acquire();
+            ++counter;
+            semaphore.Release();
+          }
+        }(semaphore, counter, n / contendersCount + (i < n % contendersCount ? 1 : 0)));
+      co_await WhenAll(tasks);
+    });
+
+    // iteration is one chunk
+    size_t const pipeChunkSize = 0x10000;
+    Measure("pipe_bandwidth", 0x1000, [pipeChunkSize](uint64_t n) -> Task<void>
+    {
+      SuspendablePipe pipe(pipeChunkSize * 16, false);
+      Task<void> writer = [](SuspendablePipe& pipe, uint64_t n, size_t chunkSize) -> Task<void>
+      {
+        std::vector<uint8_t> chunk(chunkSize, 1);
+        for(uint64_t i = 0; i < n; ++i)
+          co_await pipe.Write(chunk);
+        pipe.TryWrite({});
+      }(pipe, n, pipeChunkSize);
+      std::vector<uint8_t> buffer(pipeChunkSize);
+      for(;;)
+      {
+        size_t read = co_await pipe.Read(buffer);
+        if(!read) break;
+      }
+      co_await writer;
+    }, pipeChunkSize);
+
+    // iteration is one node of binary tree
+    Measure("fan_out_fan_in", (1 << 16) - 1, [](uint64_t n) -> Task<void>
+    {
+      struct Tree
+      {
+        static Task<uint64_t> Node(uint32_t depth)
+        {
+          if(!depth) co_return 1;
+          auto [a, b] = co_await WhenAll(Node(depth - 1), Node(depth - 1));
+          co_return a + b + 1;
+        }
+      };
+      uint32_t depth = 0;
+      while(((uint64_t(2) << depth) - 1) <= n)
+        ++depth;
+      co_await Tree::Node(depth - 1);
+    });
+  }
+
+  static void PrintHeader()
+  {
+    std::cout << "{\"benchmarks\":[";
+  }
+
+  static void PrintFooter()
+  {
+    std::cout << "\n]}\n";
+  }
+
+private:
+  template <typename F>
+  void Measure(char const* name, uint64_t iterationsCount, F const& f, uint64_t bytesPerIteration = 0)
+  {
+    // warm up
+    f(std::max<uint64_t>(iterationsCount / 10, 1)).Get();
+
+    // take best of several runs
+    double bestSeconds = 0;
+    for(size_t run = 0; run < _runsCount; ++run)
+    {
+      auto startTime = std::chrono::steady_clock::now();
+      f(iterationsCount).Get();
+      double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+      if(!run || seconds < bestSeconds)
+        bestSeconds = seconds;
+    }
+
+    std::cout << (_first ? "\n" : ",\n") << "{\"name\":\"" << name << "\",\"threads\":" << _threadsCount
+      << ",\"iterations\":" << iterationsCount << ",\"seconds\":" << bestSeconds
+      << ",\"ns_per_iteration\":" << (bestSeconds * 1e9 / (double)iterationsCount)
+      << ",\"iterations_per_second\":" << ((double)iterationsCount / bestSeconds);
+    if(bytesPerIteration)
+      std::cout << ",\"bytes_per_second\":" << ((double)(iterationsCount * bytesPerIteration) / bestSeconds);
+    std::cout << "}";
+    _first = false;
+  }
+
+  size_t const _threadsCount;
+  static constexpr size_t _runsCount = 5;
+  static inline bool _first = true;
+};
+
+int COIL_ENTRY_POINT(std::vector<std::string> args)
+{
+  // optional maximum number of threads
+  size_t maxThreadsCount = args.size() > 1 ? std::stoul(args[1]) : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+
+  Bencher::PrintHeader();
+
+  // run benchmarks on increasing number of threads
+  size_t currentThreadsCount = 0;
+  for(size_t threadsCount = 1; ; threadsCount = std::min(threadsCount * 2, maxThreadsCount))
+  {
+    for(; currentThreadsCount < threadsCount; ++currentThreadsCount)
+      TaskEngine::GetInstance().AddThread();
+    Bencher(threadsCount).Run();
+    if(threadsCount >= maxThreadsCount) break;
+  }
+
+  Bencher::PrintFooter();
+
+  return 0;
+}
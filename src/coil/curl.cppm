@@ -6,6 +6,7 @@ module;
 #define NEED_SET_SYSTEM_CERTS
 #endif
 
+#include <atomic>
 #include <coroutine>
 #include <functional>
 #include <mutex>
@@ -106,6 +107,8 @@ export namespace Coil
       // curl's default window size is used here
       size_t requestBufferSize = 32 * 1024 * 1024;
       size_t responseBufferSize = 32 * 1024 * 1024;
+      // cancelling aborts the transfer
+      CancellationToken cancellationToken;
     };
 
     class Request final : public std::enable_shared_from_this<Request>, public SuspendableInputStream, public SuspendableOutputStream
@@ -115,6 +118,7 @@ export namespace Coil
       : _pManager(std::move(pManager))
       , _requestPipe(info.requestBufferSize, true)
       , _responsePipe(info.responseBufferSize, true)
+      , _cancellationToken(info.cancellationToken)
       {
         _curl = curl_easy_init();
         // set error buffer
@@ -156,9 +160,13 @@ export namespace Coil
 
       // SuspendableInputStream methods
 
+      // response of cancelled request ends with CancelledException
       std::optional<size_t> TryRead(Buffer const& buffer) override
       {
-        return _responsePipe.TryRead(buffer);
+        std::optional<size_t> result = _responsePipe.TryRead(buffer);
+        if(!result.has_value() && _cancelled.load(std::memory_order_acquire))
+          throw CancelledException();
+        return result;
       }
 
       Task<void> WaitForRead() override
@@ -166,6 +174,26 @@ export namespace Coil
         return _responsePipe.WaitForRead();
       }
 
+      Task<void> WaitForRead(CancellationToken token) override
+      {
+        return _responsePipe.WaitForRead(std::move(token));
+      }
+
+      // zero-copy reading of response
+      // same as TryRead, response of cancelled request ends with CancelledException
+      std::optional<Buffer> AcquireReadSpan()
+      {
+        std::optional<Buffer> span = _responsePipe.AcquireReadSpan();
+        if(!span.has_value() && _cancelled.load(std::memory_order_acquire))
+          throw CancelledException();
+        return span;
+      }
+
+      void CommitRead(size_t size)
+      {
+        _responsePipe.CommitRead(size);
+      }
+
       // SuspendableOutputStream methods
 
       bool TryWrite(Buffer const& buffer) override
@@ -178,15 +206,29 @@ export namespace Coil
         return _requestPipe.WaitForWrite(size);
       }
 
-      Task<void> WaitForFinish()
+      // zero-copy writing of request
+      Buffer AcquireWriteSpan(size_t size)
+      {
+        return _requestPipe.AcquireWriteSpan(size);
+      }
+
+      void CommitWrite(size_t size)
+      {
+        _requestPipe.CommitWrite(size);
+      }
+
+      // throws CancelledException if request or waiting is cancelled
+      Task<void> WaitForFinish(CancellationToken token = {})
       {
         std::unique_lock lock{_mutex};
         while(!_optResult.has_value())
         {
-          co_await _cvResult.Wait(lock);
+          co_await _cvResult.Wait(lock, token);
         }
         // return success
         if(_optResult.value() == CURLE_OK) co_return;
+        if(_cancelled.load(std::memory_order_acquire))
+          throw CancelledException();
         // throw error, presuming error buffer has the message
         throw Exception("curl error: ") << _curlErrorBuffer;
       }
@@ -213,6 +255,34 @@ export namespace Coil
         {
           curl_multi_add_handle(curlm, pSelf->_curl);
         });
+
+        if(_cancellationToken.CanBeCancelled())
+          _stopCallback.emplace(_cancellationToken.GetStopToken(), StopCallback{this});
+      }
+
+      struct StopCallback
+      {
+        Request* pRequest;
+
+        void operator()() const
+        {
+          pRequest->Cancel();
+        }
+      };
+
+      // abort transfer in curl thread
+      void Cancel()
+      {
+        std::shared_ptr<Request> pSelf = weak_from_this().lock();
+        if(!pSelf) return;
+        _pManager->AddTask([pSelf = std::move(pSelf)](CURLM* curlm)
+        {
+          // already done
+          if(!pSelf->_pSelf) return;
+          curl_multi_remove_handle(curlm, pSelf->_curl);
+          pSelf->_cancelled.store(true, std::memory_order_release);
+          pSelf->OnDone(CURLE_ABORTED_BY_CALLBACK);
+        });
       }
 
       size_t ReadCallback(char* data, size_t size)
@@ -315,6 +385,9 @@ export namespace Coil
       char _curlErrorBuffer[CURL_ERROR_SIZE] = {};
       // reference to prevent removal
       std::shared_ptr<Request> _pSelf;
+      CancellationToken _cancellationToken;
+      std::optional<std::stop_callback<StopCallback>> _stopCallback;
+      std::atomic<bool> _cancelled = false;
       // accessed only in curl thread
       bool _requestReadPaused = false;
       bool _responseWritePaused = false;
@@ -333,6 +406,10 @@ export namespace Coil
     void ThreadHandler(std::stop_token stopToken)
     {
       CURLM* curlm = curl_multi_init();
+      {
+        std::unique_lock lock{_mutex};
+        _curlm = curlm;
+      }
 
       std::stop_callback stopCallback{stopToken, [curlm]()
       {
@@ -395,6 +472,10 @@ export namespace Coil
         }
       }
 
+      {
+        std::unique_lock lock{_mutex};
+        _curlm = nullptr;
+      }
       curl_multi_cleanup(curlm);
     }
 
@@ -402,11 +483,16 @@ export namespace Coil
     {
       std::unique_lock lock{_mutex};
       _tasks.push_back(std::move(task));
+      // wake up thread from polling
+      if(_curlm)
+        curl_multi_wakeup(_curlm);
     }
 
     std::jthread _thread;
     std::mutex _mutex;
     std::vector<std::function<void(CURLM*)>> _tasks;
+    // set while thread is running
+    CURLM* _curlm = nullptr;
     std::atomic<bool> _errored = false;
   };
 }
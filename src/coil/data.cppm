@@ -448,29 +448,67 @@ export namespace Coil
       return toRead;
     }
 
-    // push data into circular buffer
-    // auto-expands if necessary
-    void Write(Buffer const& buffer)
+    // get first contiguous part of data without consuming it
+    Buffer GetReadSpan()
     {
-      // expand buffer if necessary
+      return Buffer(_buffer.data() + _start, std::min(_size, _buffer.size() - _start));
+    }
+
+    // consume data previously obtained with GetReadSpan
+    void Consume(size_t size)
+    {
+      if(size > GetReadSpan().size)
+        throw Exception("CircularMemoryBuffer: consumed more than read span");
+      _start += size;
+      if(_start >= _buffer.size()) _start -= _buffer.size();
+      _size -= size;
+    }
+
+    // get contiguous free space right after data, without expanding buffer
+    // note: if buffer is empty, data start is moved to the beginning of buffer,
+    // to get the biggest span; this doesn't change the data, but previously
+    // obtained write span must not be used after that
+    Buffer GetWriteSpan()
+    {
+      if(!_size) _start = 0;
+      return GetFreeSpan();
+    }
+
+    // add data written into span obtained with GetWriteSpan
+    void Commit(size_t size)
+    {
+      if(size > GetFreeSpan().size)
+        throw Exception("CircularMemoryBuffer: committed more than write span");
+      _size += size;
+    }
+
+    // expand buffer to be at least of specified size
+    void Reserve(size_t bufferSize)
+    {
+      size_t oldBufferSize = _buffer.size();
+      if(bufferSize > oldBufferSize)
       {
-        size_t oldBufferSize = _buffer.size();
-        if(GetDataSize() + buffer.size > _buffer.size())
+        _buffer.resize(bufferSize);
+        // if data was wrapped around, need to move it a bit
+        size_t end = _start + _size;
+        if(end > oldBufferSize)
         {
-          _buffer.resize(GetDataSize() + buffer.size);
-          // if data was wrapped around, need to move it a bit
-          size_t end = _start + _size;
-          if(end > oldBufferSize)
-          {
-            end -= oldBufferSize;
-            // first part of [0, end) range must be moved after second part
-            size_t toMove = std::min(end, _buffer.size() - oldBufferSize);
-            std::copy_n(_buffer.data(), toMove, _buffer.data() + oldBufferSize);
-            // second part of [0, end) range must be moved back to the beginning
-            std::copy_n(_buffer.data() + toMove, end - toMove, _buffer.data());
-          }
+          end -= oldBufferSize;
+          // first part of [0, end) range must be moved after second part
+          size_t toMove = std::min(end, _buffer.size() - oldBufferSize);
+          std::copy_n(_buffer.data(), toMove, _buffer.data() + oldBufferSize);
+          // second part of [0, end) range must be moved back to the beginning
+          std::copy_n(_buffer.data() + toMove, end - toMove, _buffer.data());
         }
       }
+    }
+
+    // push data into circular buffer
+    // auto-expands if necessary
+    void Write(Buffer const& buffer)
+    {
+      // expand buffer if necessary
+      Reserve(GetDataSize() + buffer.size);
 
       // now buffer is enough, write data
 
@@ -489,6 +527,18 @@ export namespace Coil
     }
 
   private:
+    // contiguous free space right after data
+    Buffer GetFreeSpan()
+    {
+      size_t end = _start + _size;
+      if(end >= _buffer.size())
+      {
+        end -= _buffer.size();
+        return Buffer(_buffer.data() + end, _start - end);
+      }
+      return Buffer(_buffer.data() + end, _buffer.size() - end);
+    }
+
     std::vector<uint8_t> _buffer;
     size_t _start = 0;
     size_t _size = 0;
@@ -4,15 +4,19 @@ module;
 #include <concepts>
 #include <coroutine>
 #include <filesystem>
+#include <span>
 #include <string>
 #include <string_view>
 #include <variant>
+#include <vector>
 
 #if defined(COIL_PLATFORM_WINDOWS)
 #include "windows.hpp"
 #elif defined(COIL_PLATFORM_POSIX)
+#include <climits>
 #include <limits>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
@@ -25,6 +29,7 @@ export module coil.core.fs;
 
 import coil.core.base;
 import coil.core.data;
+import coil.core.tasks.io;
 import coil.core.tasks.storage;
 import coil.core.tasks;
 import coil.core.unicode;
@@ -354,14 +359,117 @@ export namespace Coil
     // AsyncReadableStorage
     Task<size_t> AsyncRead(uint64_t offset, Buffer const& buffer) const override
     {
+#if defined(COIL_PLATFORM_WINDOWS)
       co_return Read(offset, buffer);
+#elif defined(COIL_PLATFORM_POSIX)
+      uint8_t* data = (uint8_t*)buffer.data;
+      size_t size = buffer.size;
+      size_t totalReadSize = 0;
+      while(size > 0)
+      {
+        int64_t const readSize = co_await TaskIo::Read(_fd, offset, data, size);
+        if(readSize < 0)
+          throw Exception("reading file failed");
+        if(readSize == 0)
+          break;
+        totalReadSize += readSize;
+        size -= readSize;
+        data += readSize;
+        offset += readSize;
+      }
+      co_return totalReadSize;
+#endif
     }
 
+#if defined(COIL_PLATFORM_POSIX)
+    // submits all reads at once
+    Task<void> AsyncReadMany(std::span<AsyncReadRequest> requests) const override
+    {
+      std::vector<iovec> iovecs(requests.size());
+      std::vector<TaskIoOperation> operations(requests.size());
+      for(size_t i = 0; i < requests.size(); ++i)
+      {
+        iovecs[i].iov_base = requests[i].buffer.data;
+        iovecs[i].iov_len = std::min<size_t>(requests[i].buffer.size, std::numeric_limits<ssize_t>::max());
+        operations[i].type = TaskIoOperation::Type::Read;
+        operations[i].fd = _fd;
+        operations[i].offset = requests[i].offset;
+        operations[i].iovecs = &iovecs[i];
+        operations[i].iovecsCount = 1;
+      }
+      co_await TaskIo::SubmitBatch(operations);
+
+      for(size_t i = 0; i < requests.size(); ++i)
+      {
+        if(operations[i].result < 0)
+          throw Exception("reading file failed");
+        size_t readSize = operations[i].result;
+        // finish short reads
+        if(readSize > 0 && readSize < requests[i].buffer.size)
+          readSize += co_await AsyncRead(requests[i].offset + readSize, Buffer((uint8_t*)requests[i].buffer.data + readSize, requests[i].buffer.size - readSize));
+        requests[i].readSize = readSize;
+      }
+    }
+
+    // reads into all buffers with vectored read
+    Task<size_t> AsyncReadScatter(uint64_t offset, std::span<Buffer const> buffers) const override
+    {
+      std::vector<iovec> iovecs(buffers.size());
+      for(size_t i = 0; i < buffers.size(); ++i)
+      {
+        iovecs[i].iov_base = buffers[i].data;
+        iovecs[i].iov_len = buffers[i].size;
+      }
+
+      iovec* pIovecs = iovecs.data();
+      size_t iovecsCount = iovecs.size();
+      size_t totalReadSize = 0;
+      while(iovecsCount > 0)
+      {
+        int64_t const readSize = co_await TaskIo::ReadVector(_fd, offset, pIovecs, (uint32_t)std::min<size_t>(iovecsCount, IOV_MAX));
+        if(readSize < 0)
+          throw Exception("reading file failed");
+        if(readSize == 0)
+          break;
+        totalReadSize += readSize;
+        offset += readSize;
+        // skip filled buffers, and adjust partially filled one
+        size_t remainingSize = readSize;
+        while(iovecsCount > 0 && remainingSize >= pIovecs->iov_len)
+        {
+          remainingSize -= pIovecs->iov_len;
+          ++pIovecs;
+          --iovecsCount;
+        }
+        if(iovecsCount > 0)
+        {
+          pIovecs->iov_base = (uint8_t*)pIovecs->iov_base + remainingSize;
+          pIovecs->iov_len -= remainingSize;
+        }
+      }
+      co_return totalReadSize;
+    }
+#endif
+
     // AsyncWritableStorage
     Task<void> AsyncWrite(uint64_t offset, Buffer const& buffer) override
     {
+#if defined(COIL_PLATFORM_WINDOWS)
       Write(offset, buffer);
       co_return;
+#elif defined(COIL_PLATFORM_POSIX)
+      uint8_t const* data = (uint8_t const*)buffer.data;
+      size_t size = buffer.size;
+      while(size > 0)
+      {
+        int64_t const writtenSize = co_await TaskIo::Write(_fd, offset, data, size);
+        if(writtenSize <= 0)
+          throw Exception("writing file failed");
+        size -= writtenSize;
+        data += writtenSize;
+        offset += writtenSize;
+      }
+#endif
     }
 
     void SetModeExecutable(bool executable)
@@ -1,22 +1,34 @@
 module;
 
+#include <algorithm>
+#include <atomic>
 #include <concepts>
 #include <condition_variable>
 #include <coroutine>
+#include <cstddef>
+#include <cstdint>
 #include <exception>
-#include <latch>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <sstream>
+#include <new>
 #include <optional>
 #include <queue>
+#include <span>
+#include <stop_token>
+#include <string>
 #include <thread>
+#include <tuple>
 #include <type_traits>
+#include <utility>
 #include <variant>
 #include <vector>
 
 export module coil.core.tasks;
 
 import coil.core.base;
+import coil.core.time;
 
 export namespace Coil
 {
@@ -26,53 +38,302 @@ export namespace Coil
   template <typename R>
   class TaskPromise;
 
+  // lock-free work-stealing deque of coroutines (Chase-Lev)
+  // owner thread pushes and pops at the bottom, other threads steal from the top
+  class TaskDeque
+  {
+  public:
+    TaskDeque(size_t initialCapacity = 256)
+    {
+      _arrays.push_back(std::make_unique<Array>(initialCapacity));
+      _array.store(_arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    TaskDeque(TaskDeque const&) = delete;
+    TaskDeque& operator=(TaskDeque const&) = delete;
+
+    // push coroutine, owner thread only
+    void Push(std::coroutine_handle<> coroutine)
+    {
+      int64_t b = _bottom.load(std::memory_order_relaxed);
+      int64_t t = _top.load(std::memory_order_acquire);
+      Array* array = _array.load(std::memory_order_relaxed);
+      if(b - t >= (int64_t)array->capacity)
+      {
+        array = Grow(array, t, b);
+      }
+      array->Put(b, coroutine);
+      std::atomic_thread_fence(std::memory_order_release);
+      _bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // pop most recently pushed coroutine, owner thread only
+    // returns null handle if empty
+    std::coroutine_handle<> Pop()
+    {
+      int64_t b = _bottom.load(std::memory_order_relaxed) - 1;
+      Array* array = _array.load(std::memory_order_relaxed);
+      _bottom.store(b, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t t = _top.load(std::memory_order_relaxed);
+
+      // empty
+      if(t > b)
+      {
+        _bottom.store(b + 1, std::memory_order_relaxed);
+        return {};
+      }
+
+      std::coroutine_handle<> coroutine = array->Get(b);
+      // last item, race with thieves
+      if(t == b)
+      {
+        if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+          coroutine = {};
+        _bottom.store(b + 1, std::memory_order_relaxed);
+      }
+      return coroutine;
+    }
+
+    // steal least recently pushed coroutine, any thread
+    // returns null handle if empty or lost a race
+    std::coroutine_handle<> Steal()
+    {
+      int64_t t = _top.load(std::memory_order_acquire);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      int64_t b = _bottom.load(std::memory_order_acquire);
+      if(t >= b) return {};
+
+      std::coroutine_handle<> coroutine = _array.load(std::memory_order_acquire)->Get(t);
+      if(!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return {};
+      return coroutine;
+    }
+
+    // approximate number of coroutines
+    size_t GetSize() const
+    {
+      int64_t b = _bottom.load(std::memory_order_relaxed);
+      int64_t t = _top.load(std::memory_order_relaxed);
+      return b > t ? (size_t)(b - t) : 0;
+    }
+
+  private:
+    struct Array
+    {
+      Array(size_t capacity)
+      : capacity(capacity), items(new std::atomic<void*>[capacity]) {}
+
+      std::coroutine_handle<> Get(int64_t i) const
+      {
+        return std::coroutine_handle<>::from_address(items[(size_t)i & (capacity - 1)].load(std::memory_order_relaxed));
+      }
+      void Put(int64_t i, std::coroutine_handle<> coroutine)
+      {
+        items[(size_t)i & (capacity - 1)].store(coroutine.address(), std::memory_order_relaxed);
+      }
+
+      size_t const capacity;
+      std::unique_ptr<std::atomic<void*>[]> items;
+    };
+
+    Array* Grow(Array* array, int64_t t, int64_t b)
+    {
+      // old arrays are kept alive, as thieves may still read them
+      _arrays.push_back(std::make_unique<Array>(array->capacity * 2));
+      Array* newArray = _arrays.back().get();
+      for(int64_t i = t; i < b; ++i)
+        newArray->Put(i, array->Get(i));
+      _array.store(newArray, std::memory_order_release);
+      return newArray;
+    }
+
+    alignas(64) std::atomic<int64_t> _top = 0;
+    alignas(64) std::atomic<int64_t> _bottom = 0;
+    std::atomic<Array*> _array;
+    std::vector<std::unique_ptr<Array>> _arrays;
+  };
+
+  // scheduling class of coroutines
+  // workers always run higher classes first
+  enum class TaskPriority : uint8_t
+  {
+    // frame-critical work
+    Realtime,
+    // default class
+    Normal,
+    // bulk work, such as asset decoding
+    Background,
+  };
+
+  // per-worker counters, collected when instrumentation is enabled
+  struct TaskWorkerStats
+  {
+    // coroutines resumed by worker
+    uint64_t resumedCount = 0;
+    // time spent parked, in ticks
+    Time::Tick idleTicks = 0;
+    // number of times worker was unparked
+    uint64_t wakeupsCount = 0;
+    // number of times work was found while spinning, avoiding parking
+    uint64_t spinHitsCount = 0;
+    // coroutines stolen from other workers
+    uint64_t stealsCount = 0;
+    // max size of own deque (all priorities)
+    uint64_t queueDepthHighWatermark = 0;
+  };
+
+  // place to resume coroutines in
+  class TaskExecutor
+  {
+  public:
+    // schedule coroutine to run with specified priority
+    virtual void Queue(std::coroutine_handle<> coroutine, TaskPriority priority) = 0;
+
+    // executor running the current coroutine
+    // task engine if the thread is not running any executor
+    static TaskExecutor& GetCurrent();
+
+  protected:
+    static inline thread_local TaskExecutor* _tpCurrentExecutor = nullptr;
+  };
+
   // singleton class, controls thread pool
-  class TaskEngine
+  // every worker thread has its own deque per priority, coroutines queued
+  // from worker go to its deque, and idle workers steal from random victims;
+  // coroutines queued from other threads go to shared injection queue
+  class TaskEngine final : public TaskExecutor
   {
   private:
     TaskEngine() = default;
     ~TaskEngine()
     {
-      // stop threads first; this will wait for them to end
+      // stop threads first; wake up parked ones, and wait for all to end
+      for(size_t i = 0; i < _threads.size(); ++i)
+        _threads[i].request_stop();
+      _parkEpoch.fetch_add(1, std::memory_order_seq_cst);
+      _parkEpoch.notify_all();
       _threads.clear();
 
-      // destroy all remaining tasks, as they won't destroy themselves
-      while(!_coroutines.empty())
-      {
-        _coroutines.front().destroy();
-        _coroutines.pop();
-      }
+      // remaining queued coroutines are dropped, not destroyed: engine doesn't own them,
+      // task frames are referenced by Task objects which destroy them on release,
+      // and generator frames by their generators; destroying them here would
+      // destroy frames which are still referenced
     }
 
   public:
-    // schedule coroutine to run
+    // idle worker settings
+    // idle worker looks for work spinCount times, then yieldCount times
+    // yielding the thread in between, and only then parks
+    struct ParkingConfig
+    {
+      uint32_t spinCount = _defaultSpinCount;
+      uint32_t yieldCount = _defaultYieldCount;
+    };
+
+    // schedule coroutine to run with priority of the current coroutine
     void Queue(std::coroutine_handle<> coroutine)
     {
-      std::unique_lock lock(_mutex);
-      _coroutines.push(coroutine);
-      lock.unlock();
+      Queue(coroutine, _tCurrentPriority);
+    }
 
-      _cv.notify_one();
+    // schedule coroutine to run with specified priority
+    void Queue(std::coroutine_handle<> coroutine, TaskPriority priority) override
+    {
+      // worker threads push into own deque
+      if(_tpCurrentWorker && _tpCurrentWorker->pEngine == this)
+      {
+        _tpCurrentWorker->deques[(size_t)priority].Push(coroutine);
+        if(IsInstrumentationEnabled())
+        {
+          uint64_t depth = 0;
+          for(size_t i = 0; i < _prioritiesCount; ++i)
+            depth += _tpCurrentWorker->deques[i].GetSize();
+          if(depth > _tpCurrentWorker->queueDepthHighWatermark.load(std::memory_order_relaxed))
+            _tpCurrentWorker->queueDepthHighWatermark.store(depth, std::memory_order_relaxed);
+        }
+      }
+      // other threads push into injection queue
+      else
+      {
+        std::unique_lock lock(_injectionMutex);
+        _injectedCoroutines[(size_t)priority].push(coroutine);
+        _injectedCoroutinesCount.fetch_add(1, std::memory_order_relaxed);
+      }
+
+      // wake up a parked worker only if there's one
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(_parkedThreadsCount.load(std::memory_order_relaxed) > 0)
+      {
+        _parkEpoch.fetch_add(1, std::memory_order_seq_cst);
+        _parkEpoch.notify_one();
+      }
+      // helpers may reject coroutine because of its priority, so they are woken
+      // only when no worker is parked; then busy workers will get to it anyway
+      else if(_parkedHelpersCount.load(std::memory_order_relaxed) > 0)
+      {
+        _helpEpoch.fetch_add(1, std::memory_order_seq_cst);
+        _helpEpoch.notify_one();
+      }
     }
 
     // add one thread to pool
     void AddThread()
     {
-      _threads.emplace_back([this](std::stop_token const& stopToken)
+      std::unique_lock lock(_threadsMutex);
+
+      size_t workerIndex = _workersCount.load(std::memory_order_relaxed);
+      if(workerIndex >= _maxWorkersCount)
+        throw Exception("too many task engine threads");
+      _workers[workerIndex] = std::make_unique<Worker>(this, (uint32_t)workerIndex);
+      _workersCount.store(workerIndex + 1, std::memory_order_release);
+
+      _threads.emplace_back([this, pWorker = _workers[workerIndex].get()](std::stop_token const& stopToken)
       {
+        _tpCurrentWorker = pWorker;
+        _tpCurrentExecutor = this;
+
         for(;;)
         {
-          std::unique_lock lock(_mutex);
-          if(!_cv.wait(lock, stopToken, [&]()
+          TaskPriority priority;
+          std::coroutine_handle<> coroutine = FindCoroutine(pWorker, priority);
+          if(!coroutine)
+            coroutine = Spin(pWorker, priority);
+          if(!coroutine)
           {
-            return !_coroutines.empty();
-          })) break;
-          std::coroutine_handle<> coroutine = _coroutines.front();
-          _coroutines.pop();
-          lock.unlock();
+            // prepare to park; re-check for work after registering as parked,
+            // so concurrent Queue either sees us parked or we see its coroutine
+            _parkedThreadsCount.fetch_add(1, std::memory_order_seq_cst);
+            uint32_t epoch = _parkEpoch.load(std::memory_order_seq_cst);
+            // pairs with the fence in Queue: queue checks (relaxed) are not reordered before registration
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            coroutine = FindCoroutine(pWorker, priority);
+            if(!coroutine)
+            {
+              bool instrumentationEnabled = IsInstrumentationEnabled();
+              Time::Tick parkTick = instrumentationEnabled ? Time::GetTick() : 0;
+              while(_parkEpoch.load(std::memory_order_acquire) == epoch && !stopToken.stop_requested())
+                _parkEpoch.wait(epoch, std::memory_order_acquire);
+              if(instrumentationEnabled)
+              {
+                Increment(pWorker->idleTicks, Time::GetTick() - parkTick);
+                Increment(pWorker->wakeupsCount);
+              }
+            }
+            _parkedThreadsCount.fetch_sub(1, std::memory_order_relaxed);
+            if(!coroutine)
+            {
+              if(stopToken.stop_requested()) break;
+              continue;
+            }
+          }
 
-          coroutine.resume();
+          _tCurrentPriority = priority;
+          Resume(pWorker, coroutine, priority);
         }
+
+        _tpCurrentWorker = nullptr;
+        _tpCurrentExecutor = nullptr;
       });
     }
     // add numbers of threads calculated from number of hardware cores
@@ -85,257 +346,1455 @@ export namespace Coil
     // run coroutines in the current thread only until there are any
     void Run()
     {
-      for(;;)
+      TaskPriority savedPriority = _tCurrentPriority;
+      TaskExecutor* pSavedExecutor = std::exchange(_tpCurrentExecutor, this);
+      TaskPriority priority;
+      Worker* pWorker = _tpCurrentWorker && _tpCurrentWorker->pEngine == this ? _tpCurrentWorker : nullptr;
+      while(std::coroutine_handle<> coroutine = FindCoroutine(pWorker, priority))
       {
-        std::unique_lock lock(_mutex);
-        if(_coroutines.empty()) break;
-        std::coroutine_handle<> coroutine = _coroutines.front();
-        _coroutines.pop();
-        lock.unlock();
+        _tCurrentPriority = priority;
+        Resume(pWorker, coroutine, priority);
+      }
+      _tCurrentPriority = savedPriority;
+      _tpCurrentExecutor = pSavedExecutor;
+    }
 
-        coroutine.resume();
+    // run coroutines in the current thread until condition is true,
+    // parking if there's nothing to run; used by blocking waits, so the thread
+    // helps instead of sitting idle, and waits do not deadlock on a small pool
+    // only coroutines with current priority or higher are run, and nesting is limited,
+    // so the wait does not get stuck in unrelated long work
+    // returns false without waiting if nesting limit is reached
+    // condition's owner must call WakeHelpers when condition becomes true
+    template <typename F>
+    bool HelpUntil(F const& condition)
+    {
+      if(_tHelpDepth >= _maxHelpDepth) return false;
+      ++_tHelpDepth;
+      TaskPriority savedPriority = _tCurrentPriority;
+      TaskExecutor* pSavedExecutor = std::exchange(_tpCurrentExecutor, this);
+      Worker* pWorker = _tpCurrentWorker && _tpCurrentWorker->pEngine == this ? _tpCurrentWorker : nullptr;
+      while(!condition())
+      {
+        TaskPriority priority;
+        std::coroutine_handle<> coroutine = FindCoroutineForHelp(pWorker, savedPriority, priority);
+        if(!coroutine)
+        {
+          // park the same way as workers do, but on separate eventcount,
+          // so wakeups meant for workers are not consumed by helpers
+          _parkedHelpersCount.fetch_add(1, std::memory_order_seq_cst);
+          uint32_t epoch = _helpEpoch.load(std::memory_order_seq_cst);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if(!condition() && !(coroutine = FindCoroutineForHelp(pWorker, savedPriority, priority)))
+            _helpEpoch.wait(epoch, std::memory_order_acquire);
+          _parkedHelpersCount.fetch_sub(1, std::memory_order_relaxed);
+          if(!coroutine) continue;
+        }
+        _tCurrentPriority = priority;
+        Resume(pWorker, coroutine, priority);
       }
+      _tCurrentPriority = savedPriority;
+      _tpCurrentExecutor = pSavedExecutor;
+      --_tHelpDepth;
+      return true;
     }
 
-    static TaskEngine& GetInstance()
+    // wake up threads parked in HelpUntil
+    void WakeHelpers()
     {
-      static TaskEngine instance;
-      return instance;
+      _helpEpoch.fetch_add(1, std::memory_order_seq_cst);
+      _helpEpoch.notify_all();
     }
 
-  private:
-    std::mutex _mutex;
-    std::condition_variable_any _cv;
-    std::queue<std::coroutine_handle<>> _coroutines;
-    std::vector<std::jthread> _threads;
-  };
+    void SetParkingConfig(ParkingConfig const& config)
+    {
+      _spinCount.store(config.spinCount, std::memory_order_relaxed);
+      _yieldCount.store(config.yieldCount, std::memory_order_relaxed);
+    }
 
-  // coroutine promise first base class
-  class TaskPromiseBase1
-  {
-  protected:
-    // initial awaiter class
-    // queues task in the engine after initial suspend
-    class InitialAwaiter
+    ParkingConfig GetParkingConfig() const
     {
-    public:
-      bool await_ready() const
-      {
-        return false;
-      }
-      void await_suspend(std::coroutine_handle<> const& coroutine) const
+      return
       {
-        TaskEngine::GetInstance().Queue(coroutine);
-      }
-      void await_resume() const
+        .spinCount = _spinCount.load(std::memory_order_relaxed),
+        .yieldCount = _yieldCount.load(std::memory_order_relaxed),
+      };
+    }
+
+    // number of worker threads
+    size_t GetThreadsCount() const
+    {
+      return _workersCount.load(std::memory_order_acquire);
+    }
+
+    // enable or disable collecting of stats and resume timeline
+    // disabled by default; costs a single relaxed load per resume when disabled
+    void SetInstrumentation(bool enabled)
+    {
+      _instrumentationEnabled.store(enabled, std::memory_order_relaxed);
+    }
+
+    // get stats of every worker
+    std::vector<TaskWorkerStats> GetWorkerStats() const
+    {
+      size_t workersCount = _workersCount.load(std::memory_order_acquire);
+      std::vector<TaskWorkerStats> stats(workersCount);
+      for(size_t i = 0; i < workersCount; ++i)
       {
+        Worker const& worker = *_workers[i];
+        stats[i].resumedCount = worker.resumedCount.load(std::memory_order_relaxed);
+        stats[i].idleTicks = worker.idleTicks.load(std::memory_order_relaxed);
+        stats[i].wakeupsCount = worker.wakeupsCount.load(std::memory_order_relaxed);
+        stats[i].spinHitsCount = worker.spinHitsCount.load(std::memory_order_relaxed);
+        stats[i].stealsCount = worker.stealsCount.load(std::memory_order_relaxed);
+        stats[i].queueDepthHighWatermark = worker.queueDepthHighWatermark.load(std::memory_order_relaxed);
       }
-    };
+      return stats;
+    }
 
-    // final awaiter class
-    // destroys coroutine after final suspend
-    class FinalAwaiter
+    // reset stats and timeline
+    // counters are reset racily, so better do it when instrumentation is disabled
+    void ResetInstrumentation()
     {
-    public:
-      bool await_ready() const noexcept
+      size_t workersCount = _workersCount.load(std::memory_order_acquire);
+      for(size_t i = 0; i < workersCount; ++i)
       {
-        return false;
+        Worker& worker = *_workers[i];
+        worker.resumedCount.store(0, std::memory_order_relaxed);
+        worker.idleTicks.store(0, std::memory_order_relaxed);
+        worker.wakeupsCount.store(0, std::memory_order_relaxed);
+        worker.spinHitsCount.store(0, std::memory_order_relaxed);
+        worker.stealsCount.store(0, std::memory_order_relaxed);
+        worker.queueDepthHighWatermark.store(0, std::memory_order_relaxed);
+        std::unique_lock lock(worker.timelineMutex);
+        worker.timeline.clear();
       }
-      void await_suspend(std::coroutine_handle<> const& coroutine) const noexcept
+    }
+
+    // export resume timeline in Chrome trace event format (JSON),
+    // viewable in chrome://tracing or Perfetto
+    std::string ExportChromeTrace()
+    {
+      std::ostringstream stream;
+      stream << std::fixed << "{\"traceEvents\":[";
+      bool first = true;
+      auto ticksToMicroseconds = [](Time::Tick ticks)
       {
-        coroutine.destroy();
-      }
-      void await_resume() const noexcept
+        return (double)ticks * 1000000.0 / (double)Time::ticksPerSecond;
+      };
+      size_t workersCount = _workersCount.load(std::memory_order_acquire);
+      for(size_t i = 0; i < workersCount; ++i)
       {
+        Worker& worker = *_workers[i];
+        if(!first) stream << ',';
+        first = false;
+        stream << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << i << ",\"args\":{\"name\":\"worker " << i << "\"}}";
+        std::unique_lock lock(worker.timelineMutex);
+        for(TimelineEvent const& event : worker.timeline)
+        {
+          static char const* const priorityNames[] = { "realtime", "normal", "background" };
+          stream
+            << ",{\"name\":\"coroutine\",\"cat\":\"" << priorityNames[(size_t)event.priority]
+            << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << i
+            << ",\"ts\":" << ticksToMicroseconds(event.startTick)
+            << ",\"dur\":" << ticksToMicroseconds(event.endTick - event.startTick)
+            << ",\"args\":{\"coroutine\":\"" << event.coroutine << "\"}}";
+        }
       }
-    };
-  };
+      stream << "]}";
+      return stream.str();
+    }
 
-  // coroutine promise second base class
-  // implements everything except void/non-void distinction
-  template <typename R>
-  class TaskPromiseBase2 : public TaskPromiseBase1
-  {
-  public:
-    InitialAwaiter initial_suspend()
+    // priority of the currently running coroutine
+    static TaskPriority GetCurrentPriority()
     {
-      return {};
+      return _tCurrentPriority;
     }
-    FinalAwaiter final_suspend() noexcept
+
+    static TaskEngine& GetInstance()
     {
-      return {};
+      static TaskEngine instance;
+      return instance;
     }
 
-    Task<R> get_return_object()
+  private:
+    static constexpr size_t _prioritiesCount = 3;
+    // every that many coroutines background ones are looked for first
+    static constexpr uint32_t _backgroundStarvationLimit = 32;
+
+    // resume of a coroutine by a worker
+    struct TimelineEvent
     {
-      return Task<R>(_pResult);
-    }
+      void* coroutine;
+      Time::Tick startTick;
+      Time::Tick endTick;
+      TaskPriority priority;
+    };
 
-    void unhandled_exception()
+    struct Worker
     {
-      _pResult->SetException();
-    }
+      Worker(TaskEngine* pEngine, uint32_t index)
+      : pEngine(pEngine), index(index), randomState(index * 0x9E3779B9 + 1) {}
 
-  protected:
-    struct Void {};
-    using Value = std::conditional_t<std::same_as<R, void>, Void, R>;
+      TaskEngine* const pEngine;
+      uint32_t const index;
+      TaskDeque deques[_prioritiesCount];
+      // xorshift state for choosing victims
+      uint32_t randomState;
+      // number of coroutines run since last background one
+      uint32_t backgroundStarvation = 0;
+
+      // instrumentation counters, written by worker only
+      std::atomic<uint64_t> resumedCount = 0;
+      std::atomic<Time::Tick> idleTicks = 0;
+      std::atomic<uint64_t> wakeupsCount = 0;
+      std::atomic<uint64_t> spinHitsCount = 0;
+      std::atomic<uint64_t> stealsCount = 0;
+      std::atomic<uint64_t> queueDepthHighWatermark = 0;
+      // resume timeline
+      std::mutex timelineMutex;
+      std::vector<TimelineEvent> timeline;
+    };
 
-    // storage class
-    // stores result so promise can be destroyed separately
-    class Result
+    // increment counter written by a single thread
+    static void Increment(std::atomic<uint64_t>& counter, uint64_t value = 1)
     {
-    public:
-      Result() : _latch(1) {}
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    bool IsInstrumentationEnabled() const
+    {
+      return _instrumentationEnabled.load(std::memory_order_relaxed);
+    }
 
-      void SetValue(Value const& value)
+    // resume coroutine in worker, recording stats if needed
+    void Resume(Worker* pWorker, std::coroutine_handle<> coroutine, TaskPriority priority)
+    {
+      if(!pWorker || !IsInstrumentationEnabled())
       {
-        SetResult([&]()
-        {
-          _result.emplace(value);
-        });
+        coroutine.resume();
+        return;
       }
-      void SetValue(Value&& value)
+
+      Increment(pWorker->resumedCount);
+      // coroutine may be destroyed during resume, so remember address
+      void* address = coroutine.address();
+      Time::Tick startTick = Time::GetTick();
+      coroutine.resume();
+      Time::Tick endTick = Time::GetTick();
+      std::unique_lock lock(pWorker->timelineMutex);
+      if(pWorker->timeline.size() < _maxTimelineEventsCount)
+        pWorker->timeline.push_back({ address, startTick, endTick, priority });
+    }
+
+    // look for work for a while before parking
+    std::coroutine_handle<> Spin(Worker* pWorker, TaskPriority& priority)
+    {
+      uint32_t spinCount = _spinCount.load(std::memory_order_relaxed);
+      uint32_t yieldCount = _yieldCount.load(std::memory_order_relaxed);
+      for(uint32_t i = 0; i < spinCount + yieldCount; ++i)
       {
-        SetResult([&]()
+        if(i >= spinCount)
+          std::this_thread::yield();
+        if(std::coroutine_handle<> coroutine = FindCoroutine(pWorker, priority))
         {
-          _result.emplace(std::move(value));
-        });
+          if(IsInstrumentationEnabled())
+            Increment(pWorker->spinHitsCount);
+          return coroutine;
+        }
       }
+      return {};
+    }
 
-      void SetException()
+    // find coroutine to run, from highest priority to lowest:
+    // own deque first, then injection queue, then steal
+    // worker is null for non-worker threads
+    std::coroutine_handle<> FindCoroutine(Worker* pWorker, TaskPriority& priority)
+    {
+      // give background coroutines a chance, so they are not starved
+      if(pWorker && ++pWorker->backgroundStarvation >= _backgroundStarvationLimit)
       {
-        SetResult([&]()
+        pWorker->backgroundStarvation = 0;
+        if(std::coroutine_handle<> coroutine = FindCoroutineWithPriority(pWorker, TaskPriority::Background))
         {
-          _result.emplace(std::current_exception());
-        });
+          priority = TaskPriority::Background;
+          return coroutine;
+        }
       }
 
-      template <typename F>
-      void SetResult(F const& f)
+      for(size_t i = 0; i < _prioritiesCount; ++i)
       {
-        // set result, and extract list of listeners
-        std::unique_lock lock(_mutex);
-        f();
-        std::vector<std::coroutine_handle<>> listeners;
-        std::swap(listeners, _listeners);
-        lock.unlock();
-
-        // notify listeners
-        for(size_t i = 0; i < listeners.size(); ++i)
-          TaskEngine::GetInstance().Queue(listeners[i]);
-        // unsnap latch
-        _latch.count_down();
+        if(std::coroutine_handle<> coroutine = FindCoroutineWithPriority(pWorker, (TaskPriority)i))
+        {
+          priority = (TaskPriority)i;
+          if(pWorker && priority == TaskPriority::Background)
+            pWorker->backgroundStarvation = 0;
+          return coroutine;
+        }
       }
+      return {};
+    }
 
-      bool AwaitReady() const
+    // find coroutine with specified priority or higher, for helping thread
+    std::coroutine_handle<> FindCoroutineForHelp(Worker* pWorker, TaskPriority maxPriority, TaskPriority& priority)
+    {
+      for(size_t i = 0; i <= (size_t)maxPriority; ++i)
       {
-        // skip suspend if there's value already
-        std::unique_lock lock(_mutex);
-        return _result.has_value();
+        if(std::coroutine_handle<> coroutine = FindCoroutineWithPriority(pWorker, (TaskPriority)i))
+        {
+          priority = (TaskPriority)i;
+          return coroutine;
+        }
       }
+      return {};
+    }
 
-      bool AwaitSuspend(std::coroutine_handle<> coroutine)
+    std::coroutine_handle<> FindCoroutineWithPriority(Worker* pWorker, TaskPriority priority)
+    {
+      if(pWorker)
       {
-        // unsuspend if there's value already
-        // otherwise add current coroutine to listeners
-        std::unique_lock lock(_mutex);
-        if(_result.has_value()) return false;
-        _listeners.push_back(coroutine);
-        return true;
+        if(std::coroutine_handle<> coroutine = pWorker->deques[(size_t)priority].Pop())
+          return coroutine;
       }
 
-      R AwaitResume() const
+      if(_injectedCoroutinesCount.load(std::memory_order_relaxed) > 0)
       {
-        // return value or rethrow exception
-        return std::visit([&]<typename V>(V const& result) -> R
+        std::unique_lock lock(_injectionMutex);
+        std::queue<std::coroutine_handle<>>& coroutines = _injectedCoroutines[(size_t)priority];
+        if(!coroutines.empty())
         {
-          if constexpr(std::same_as<V, Value>)
-          {
-            if constexpr(!std::same_as<R, void>)
-            {
-              return result;
-            }
-          }
-          else
-          {
-            std::rethrow_exception(result);
-          }
-        }, _result.value());
-      }
-
-      // wait for result
-      R Get() const
-      {
-        _latch.wait();
-        return AwaitResume();
+          std::coroutine_handle<> coroutine = coroutines.front();
+          coroutines.pop();
+          _injectedCoroutinesCount.fetch_sub(1, std::memory_order_relaxed);
+          return coroutine;
+        }
       }
 
-    private:
-      std::latch _latch;
-      mutable std::mutex _mutex;
-      std::optional<std::variant<Value, std::exception_ptr>> _result;
-      std::vector<std::coroutine_handle<>> _listeners;
-    };
+      return Steal(pWorker, priority);
+    }
 
-    // task awaiter class
-    // just wraps shared_ptr to result class
-    class ResultAwaiter
+    // try to steal coroutine from other workers, starting from random victim
+    std::coroutine_handle<> Steal(Worker* pWorker, TaskPriority priority)
     {
-    public:
-      ResultAwaiter(std::shared_ptr<Result> const& pResult)
-      : _pResult(pResult) {}
+      size_t workersCount = _workersCount.load(std::memory_order_acquire);
+      if(!workersCount) return {};
 
-      bool await_ready() const
+      uint32_t start;
+      if(pWorker)
       {
-        return _pResult->AwaitReady();
+        uint32_t& x = pWorker->randomState;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        start = x;
       }
-
-      bool await_suspend(std::coroutine_handle<> coroutine)
+      else
       {
-        return _pResult->AwaitSuspend(coroutine);
+        start = 0;
       }
 
-      R await_resume() const
+      for(size_t i = 0; i < workersCount; ++i)
       {
-        return _pResult->AwaitResume();
+        Worker* pVictim = _workers[(start + i) % workersCount].get();
+        if(pVictim == pWorker) continue;
+        if(std::coroutine_handle<> coroutine = pVictim->deques[(size_t)priority].Steal())
+        {
+          if(pWorker && IsInstrumentationEnabled())
+            Increment(pWorker->stealsCount);
+          return coroutine;
+        }
       }
+      return {};
+    }
 
-    private:
-      std::shared_ptr<Result> _pResult;
-    };
+    static constexpr size_t _maxWorkersCount = 256;
 
-    std::shared_ptr<Result> _pResult = std::make_shared<Result>();
+    // workers are only added, never removed
+    std::unique_ptr<Worker> _workers[_maxWorkersCount];
+    std::atomic<size_t> _workersCount = 0;
+    std::mutex _threadsMutex;
+    std::vector<std::jthread> _threads;
 
-    friend class Task<R>;
+    std::mutex _injectionMutex;
+    std::queue<std::coroutine_handle<>> _injectedCoroutines[_prioritiesCount];
+    std::atomic<size_t> _injectedCoroutinesCount = 0;
+
+    // eventcount for parking idle workers
+    std::atomic<size_t> _parkedThreadsCount = 0;
+    std::atomic<uint32_t> _parkEpoch = 0;
+    // eventcount for threads parked in HelpUntil
+    std::atomic<size_t> _parkedHelpersCount = 0;
+    std::atomic<uint32_t> _helpEpoch = 0;
+    static constexpr uint32_t _defaultSpinCount = 64;
+    static constexpr uint32_t _defaultYieldCount = 4;
+    std::atomic<uint32_t> _spinCount = _defaultSpinCount;
+    std::atomic<uint32_t> _yieldCount = _defaultYieldCount;
+
+    std::atomic<bool> _instrumentationEnabled = false;
+    // limit of timeline events per worker
+    static constexpr size_t _maxTimelineEventsCount = 0x100000;
+
+    static inline thread_local Worker* _tpCurrentWorker = nullptr;
+    static inline thread_local TaskPriority _tCurrentPriority = TaskPriority::Normal;
+    // nesting of HelpUntil in the current thread
+    static constexpr uint32_t _maxHelpDepth = 4;
+    static inline thread_local uint32_t _tHelpDepth = 0;
+
+    friend class TaskPriorityScope;
   };
 
-  // non-void task promise class
-  template <typename R>
-  class TaskPromise : public TaskPromiseBase2<R>
+  TaskExecutor& TaskExecutor::GetCurrent()
+  {
+    return _tpCurrentExecutor ? *_tpCurrentExecutor : TaskEngine::GetInstance();
+  }
+
+  // sets priority for tasks started in the current thread while in scope
+  // must not be held across co_await
+  class TaskPriorityScope
   {
   public:
-    void return_value(R const& value)
+    TaskPriorityScope(TaskPriority priority)
+    : _savedPriority(TaskEngine::_tCurrentPriority)
     {
-      this->_pResult->SetValue(value);
+      TaskEngine::_tCurrentPriority = priority;
     }
-    void return_value(R&& value)
+    ~TaskPriorityScope()
     {
-      this->_pResult->SetValue(std::move(value));
+      TaskEngine::_tCurrentPriority = _savedPriority;
     }
+
+    TaskPriorityScope(TaskPriorityScope const&) = delete;
+    TaskPriorityScope& operator=(TaskPriorityScope const&) = delete;
+
+  private:
+    TaskPriority const _savedPriority;
   };
-  // void task promise class
-  template <>
-  class TaskPromise<void> : public TaskPromiseBase2<void>
+
+  // awaiter to continue current coroutine with different priority
+  class SwitchPriority
   {
   public:
-    void return_void()
+    SwitchPriority(TaskPriority priority)
+    : _priority(priority) {}
+
+    bool await_ready() const
     {
-      this->_pResult->SetValue({});
+      return TaskEngine::GetCurrentPriority() == _priority;
+    }
+
+    void await_suspend(std::coroutine_handle<> coroutine) const
+    {
+      TaskExecutor::GetCurrent().Queue(coroutine, _priority);
+    }
+
+    void await_resume() const
+    {
+    }
+
+  private:
+    TaskPriority const _priority;
+  };
+
+  // executor running coroutines in a specific thread, e.g. main or render thread
+  // the thread must call Run periodically (e.g. once per frame)
+  class TaskThreadExecutor : public TaskExecutor
+  {
+  public:
+    void Queue(std::coroutine_handle<> coroutine, TaskPriority priority) override
+    {
+      {
+        std::unique_lock lock(_mutex);
+        _coroutines[(size_t)priority].push_back(coroutine);
+      }
+      _cv.notify_one();
+    }
+
+    // run coroutines queued so far, in priority order
+    // coroutines queued while running are left for the next run
+    // must be called from the executor's thread only, not reentrant
+    // returns number of coroutines run
+    size_t Run()
+    {
+      {
+        std::unique_lock lock(_mutex);
+        for(size_t i = 0; i < _prioritiesCount; ++i)
+        {
+          _runningCoroutines[i].clear();
+          std::swap(_runningCoroutines[i], _coroutines[i]);
+        }
+      }
+
+      TaskExecutor* pSavedExecutor = std::exchange(_tpCurrentExecutor, this);
+      size_t count = 0;
+      for(size_t i = 0; i < _prioritiesCount; ++i)
+      {
+        TaskPriorityScope priorityScope((TaskPriority)i);
+        for(size_t j = 0; j < _runningCoroutines[i].size(); ++j)
+          _runningCoroutines[i][j].resume();
+        count += _runningCoroutines[i].size();
+      }
+      _tpCurrentExecutor = pSavedExecutor;
+
+      return count;
+    }
+
+    // block until there's something to run
+    void Wait()
+    {
+      std::unique_lock lock(_mutex);
+      _cv.wait(lock, [&]()
+      {
+        for(size_t i = 0; i < _prioritiesCount; ++i)
+          if(!_coroutines[i].empty()) return true;
+        return false;
+      });
+    }
+
+  private:
+    static constexpr size_t _prioritiesCount = 3;
+
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    std::vector<std::coroutine_handle<>> _coroutines[_prioritiesCount];
+    // buffers swapped with queues on every run, to keep allocated memory
+    std::vector<std::coroutine_handle<>> _runningCoroutines[_prioritiesCount];
+  };
+
+  // awaiter to continue current coroutine in specified executor
+  class ResumeOn
+  {
+  public:
+    ResumeOn(TaskExecutor& executor)
+    : _executor(executor) {}
+
+    bool await_ready() const
+    {
+      return &TaskExecutor::GetCurrent() == &_executor;
+    }
+
+    void await_suspend(std::coroutine_handle<> coroutine) const
+    {
+      _executor.Queue(coroutine, TaskEngine::GetCurrentPriority());
+    }
+
+    void await_resume() const
+    {
+    }
+
+  private:
+    TaskExecutor& _executor;
+  };
+
+  // node for getting notified about task completion
+  // stored by the waiting side (usually in awaiter), so waiting does not allocate
+  struct TaskWaiter
+  {
+    TaskWaiter* next = nullptr;
+    // coroutine to resume
+    std::coroutine_handle<> coroutine;
+    TaskExecutor* pExecutor = nullptr;
+    TaskPriority priority = TaskPriority::Normal;
+    // if set, called instead of resuming coroutine
+    void (*callback)(TaskWaiter& waiter) = nullptr;
+  };
+
+  // thrown by operations interrupted by cancellation
+  class CancelledException : public Exception
+  {
+  public:
+    CancelledException()
+    : Exception("operation cancelled") {}
+  };
+
+  // cooperative cancellation token
+  // tasks can check it, and cancellable awaitables wake up promptly with CancelledException
+  // default-constructed token is never cancelled
+  class CancellationToken
+  {
+  public:
+    CancellationToken() = default;
+
+    bool IsCancelled() const
+    {
+      return _token.stop_requested();
+    }
+
+    // whether token may ever get cancelled
+    bool CanBeCancelled() const
+    {
+      return _token.stop_possible();
+    }
+
+    void ThrowIfCancelled() const
+    {
+      if(IsCancelled())
+        throw CancelledException();
+    }
+
+    // for registering std::stop_callback
+    std::stop_token const& GetStopToken() const
+    {
+      return _token;
+    }
+
+  private:
+    CancellationToken(std::stop_token token)
+    : _token(std::move(token)) {}
+
+    std::stop_token _token;
+
+    friend class CancellationSource;
+  };
+
+  // source of cancellation tokens
+  class CancellationSource
+  {
+  public:
+    CancellationToken GetToken() const
+    {
+      return _source.get_token();
+    }
+
+    // returns false if already cancelled
+    bool Cancel()
+    {
+      return _source.request_stop();
+    }
+
+    bool IsCancelled() const
+    {
+      return _source.stop_requested();
+    }
+
+  private:
+    std::stop_source _source;
+  };
+
+  // waiter which is woken up exactly once, either normally or by cancellation
+  // usage in awaiter's await_suspend: Start, then register waiter somewhere, then return Finish();
+  // coroutine is not resumed until Finish, so registration is safe to race with wake up.
+  // Cancellation calls specified function, which should unregister the waiter,
+  // and call WakeCancelled only if unregistering succeeded; it may be called more than once
+  class CancellableWaiter : public TaskWaiter
+  {
+  public:
+    CancellableWaiter() = default;
+    CancellableWaiter(CancellableWaiter const&) = delete;
+    CancellableWaiter& operator=(CancellableWaiter const&) = delete;
+
+    void Start(std::coroutine_handle<> coroutine, CancellationToken const& token, void (*cancel)(CancellableWaiter& waiter))
+    {
+      this->coroutine = coroutine;
+      this->pExecutor = &TaskExecutor::GetCurrent();
+      this->priority = TaskEngine::GetCurrentPriority();
+      this->callback = &OnWoken;
+      _cancel = cancel;
+      // callback may be called right away, waiter is not registered yet though
+      if(token.CanBeCancelled())
+        _stopCallback.emplace(token.GetStopToken(), StopCallback{this});
+    }
+
+    // returns whether coroutine should stay suspended
+    bool Finish()
+    {
+      // cancellation might have happened before registration
+      if(_cancelRequested.load(std::memory_order_acquire))
+        _cancel(*this);
+      return !Release();
+    }
+
+    // wake up normally
+    void Wake()
+    {
+      if(Release())
+        pExecutor->Queue(coroutine, priority);
+    }
+
+    // wake up with cancellation
+    void WakeCancelled()
+    {
+      _cancelled = true;
+      Wake();
+    }
+
+    // to be called in await_resume
+    void ThrowIfCancelled()
+    {
+      // wait for cancellation callback to finish
+      _stopCallback.reset();
+      if(_cancelled)
+        throw CancelledException();
+    }
+
+  private:
+    struct StopCallback
+    {
+      CancellableWaiter* pWaiter;
+
+      void operator()() const
+      {
+        pWaiter->_cancelRequested.store(true, std::memory_order_release);
+        pWaiter->_cancel(*pWaiter);
+      }
+    };
+
+    static void OnWoken(TaskWaiter& waiter)
+    {
+      static_cast<CancellableWaiter&>(waiter).Wake();
+    }
+
+    // returns true if it was the last of registration and wake up
+    bool Release()
+    {
+      return _pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    void (*_cancel)(CancellableWaiter& waiter) = nullptr;
+    std::optional<std::stop_callback<StopCallback>> _stopCallback;
+    // one for registration, one for wake up
+    std::atomic<uint32_t> _pendingCount = 2;
+    std::atomic<bool> _cancelRequested = false;
+    bool _cancelled = false;
+  };
+
+  // pooled allocator for coroutine frames
+  // frames are rounded up to size classes; freed frames are kept
+  // in thread-local freelists, with global pool taking the overflow
+  class TaskFrameAllocator
+  {
+  public:
+    struct Config
+    {
+      // whether to pool frames at all
+      bool enabled = true;
+      // maximum size of frames kept by every thread
+      size_t maxThreadCacheSize = 256 * 1024;
+      // maximum size of frames kept in global pool
+      size_t maxGlobalPoolSize = 16 * 1024 * 1024;
+    };
+
+    struct Stats
+    {
+      // allocations served from freelists
+      uint64_t hits = 0;
+      // allocations served from heap
+      uint64_t misses = 0;
+      // total size of frames kept in freelists
+      uint64_t retainedSize = 0;
+    };
+
+    static void* Allocate(size_t size)
+    {
+      size_t sizeClass = GetSizeClass(size);
+      // too big frames, or pool is disabled
+      if(sizeClass >= _sizeClassesCount || !GetGlobal().enabled.load(std::memory_order_relaxed))
+        return AllocateFromHeap(sizeClass, size);
+
+      ThreadCache* pCache = GetThreadCache();
+      if(!pCache)
+        return AllocateFromHeap(sizeClass, size);
+
+      // take from own freelist, refilling it from global pool if needed
+      if(!pCache->freelists[sizeClass].first)
+        pCache->Refill(sizeClass);
+      if(Block* block = pCache->freelists[sizeClass].Pop())
+      {
+        pCache->cachedSize.store(pCache->cachedSize.load(std::memory_order_relaxed) - GetClassSize(sizeClass), std::memory_order_relaxed);
+        pCache->hits.store(pCache->hits.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return block;
+      }
+
+      pCache->misses.store(pCache->misses.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return AllocateFromHeap(sizeClass, size);
+    }
+
+    static void Deallocate(void* data, size_t size)
+    {
+      size_t sizeClass = GetSizeClass(size);
+      if(sizeClass >= _sizeClassesCount || !GetGlobal().enabled.load(std::memory_order_relaxed))
+      {
+        ::operator delete(data);
+        return;
+      }
+
+      ThreadCache* pCache = GetThreadCache();
+      if(!pCache)
+      {
+        ::operator delete(data);
+        return;
+      }
+
+      pCache->freelists[sizeClass].Push(static_cast<Block*>(data));
+      size_t cachedSize = pCache->cachedSize.load(std::memory_order_relaxed) + GetClassSize(sizeClass);
+      pCache->cachedSize.store(cachedSize, std::memory_order_relaxed);
+      // give away half of the freelist if thread keeps too much
+      if(cachedSize > GetGlobal().maxThreadCacheSize.load(std::memory_order_relaxed))
+        pCache->Flush(sizeClass, (pCache->freelists[sizeClass].count + 1) / 2);
+    }
+
+    static void SetConfig(Config const& config)
+    {
+      Global& global = GetGlobal();
+      global.enabled.store(config.enabled, std::memory_order_relaxed);
+      global.maxThreadCacheSize.store(config.maxThreadCacheSize, std::memory_order_relaxed);
+      global.maxGlobalPoolSize.store(config.maxGlobalPoolSize, std::memory_order_relaxed);
+    }
+
+    static Config GetConfig()
+    {
+      Global& global = GetGlobal();
+      return
+      {
+        .enabled = global.enabled.load(std::memory_order_relaxed),
+        .maxThreadCacheSize = global.maxThreadCacheSize.load(std::memory_order_relaxed),
+        .maxGlobalPoolSize = global.maxGlobalPoolSize.load(std::memory_order_relaxed),
+      };
+    }
+
+    static Stats GetStats()
+    {
+      Global& global = GetGlobal();
+      std::unique_lock lock(global.mutex);
+      Stats stats = global.exitedThreadsStats;
+      for(size_t i = 0; i < global.threadCaches.size(); ++i)
+      {
+        ThreadCache const* pCache = global.threadCaches[i];
+        stats.hits += pCache->hits.load(std::memory_order_relaxed);
+        stats.misses += pCache->misses.load(std::memory_order_relaxed);
+        stats.retainedSize += pCache->cachedSize.load(std::memory_order_relaxed);
+      }
+      stats.retainedSize += global.cachedSize;
+      return stats;
+    }
+
+  private:
+    struct Block
+    {
+      Block* next;
+    };
+
+    struct Freelist
+    {
+      void Push(Block* block)
+      {
+        block->next = first;
+        first = block;
+        ++count;
+      }
+      Block* Pop()
+      {
+        Block* block = first;
+        if(block)
+        {
+          first = block->next;
+          --count;
+        }
+        return block;
+      }
+
+      Block* first = nullptr;
+      size_t count = 0;
+    };
+
+    static constexpr size_t _sizeClassGranularity = 64;
+    static constexpr size_t _sizeClassesCount = 32;
+    // number of frames taken from global pool at once
+    static constexpr size_t _refillCount = 16;
+
+    static size_t GetSizeClass(size_t size)
+    {
+      return (size + _sizeClassGranularity - 1) / _sizeClassGranularity - 1;
+    }
+    static size_t GetClassSize(size_t sizeClass)
+    {
+      return (sizeClass + 1) * _sizeClassGranularity;
+    }
+
+    // frames in heap are allocated with rounded size, so they are interchangeable
+    // with pooled ones regardless of configuration changes
+    static void* AllocateFromHeap(size_t sizeClass, size_t size)
+    {
+      return ::operator new(sizeClass < _sizeClassesCount ? GetClassSize(sizeClass) : size);
+    }
+
+    struct ThreadCache;
+
+    struct Global
+    {
+      std::atomic<bool> enabled = true;
+      std::atomic<size_t> maxThreadCacheSize = Config{}.maxThreadCacheSize;
+      std::atomic<size_t> maxGlobalPoolSize = Config{}.maxGlobalPoolSize;
+
+      std::mutex mutex;
+      Freelist freelists[_sizeClassesCount];
+      // counts of freelists, readable without lock
+      std::atomic<size_t> counts[_sizeClassesCount] = {};
+      size_t cachedSize = 0;
+      std::vector<ThreadCache const*> threadCaches;
+      Stats exitedThreadsStats;
+    };
+
+    struct ThreadCache
+    {
+      ThreadCache()
+      {
+        Global& global = GetGlobal();
+        std::unique_lock lock(global.mutex);
+        global.threadCaches.push_back(this);
+      }
+
+      ~ThreadCache()
+      {
+        for(size_t i = 0; i < _sizeClassesCount; ++i)
+          Flush(i, freelists[i].count);
+
+        Global& global = GetGlobal();
+        std::unique_lock lock(global.mutex);
+        global.threadCaches.erase(std::find(global.threadCaches.begin(), global.threadCaches.end(), this));
+        global.exitedThreadsStats.hits += hits.load(std::memory_order_relaxed);
+        global.exitedThreadsStats.misses += misses.load(std::memory_order_relaxed);
+      }
+
+      // take some frames from global pool
+      void Refill(size_t sizeClass)
+      {
+        Global& global = GetGlobal();
+        // do not lock if global pool is empty, so misses go to heap without contention
+        if(!global.counts[sizeClass].load(std::memory_order_relaxed)) return;
+        std::unique_lock lock(global.mutex);
+        size_t count = 0;
+        for(; count < _refillCount; ++count)
+        {
+          Block* block = global.freelists[sizeClass].Pop();
+          if(!block) break;
+          freelists[sizeClass].Push(block);
+        }
+        global.cachedSize -= count * GetClassSize(sizeClass);
+        global.counts[sizeClass].store(global.freelists[sizeClass].count, std::memory_order_relaxed);
+        lock.unlock();
+
+        cachedSize.store(cachedSize.load(std::memory_order_relaxed) + count * GetClassSize(sizeClass), std::memory_order_relaxed);
+      }
+
+      // give some frames to global pool, or free them if global pool is full
+      void Flush(size_t sizeClass, size_t count)
+      {
+        size_t classSize = GetClassSize(sizeClass);
+        cachedSize.store(cachedSize.load(std::memory_order_relaxed) - count * classSize, std::memory_order_relaxed);
+
+        Global& global = GetGlobal();
+        size_t maxGlobalPoolSize = global.maxGlobalPoolSize.load(std::memory_order_relaxed);
+        std::unique_lock lock(global.mutex);
+        for(; count > 0 && global.cachedSize + classSize <= maxGlobalPoolSize; --count)
+        {
+          global.freelists[sizeClass].Push(freelists[sizeClass].Pop());
+          global.cachedSize += classSize;
+        }
+        global.counts[sizeClass].store(global.freelists[sizeClass].count, std::memory_order_relaxed);
+        lock.unlock();
+
+        for(; count > 0; --count)
+          ::operator delete(freelists[sizeClass].Pop());
+      }
+
+      Freelist freelists[_sizeClassesCount];
+      // written only by owner thread, read by stats
+      std::atomic<size_t> cachedSize = 0;
+      std::atomic<uint64_t> hits = 0;
+      std::atomic<uint64_t> misses = 0;
+    };
+
+    // global state is never destroyed, as frames may be freed during static destruction
+    static Global& GetGlobal()
+    {
+      static Global& global = *new Global();
+      return global;
+    }
+
+    enum class ThreadCacheState
+    {
+      None,
+      Alive,
+      Destroyed,
+    };
+
+    struct ThreadCacheHolder
+    {
+      ThreadCacheHolder()
+      {
+        _tThreadCacheState = ThreadCacheState::Alive;
+      }
+      ~ThreadCacheHolder()
+      {
+        _tThreadCacheState = ThreadCacheState::Destroyed;
+      }
+
+      ThreadCache cache;
+    };
+
+    // returns null if thread cache is already destroyed
+    static ThreadCache* GetThreadCache()
+    {
+      if(_tThreadCacheState == ThreadCacheState::Destroyed) return nullptr;
+      static thread_local ThreadCacheHolder holder;
+      return &holder.cache;
+    }
+
+    static inline thread_local ThreadCacheState _tThreadCacheState = ThreadCacheState::None;
+  };
+
+  // bump allocator for short-lived temporary allocations
+  // individual deallocations are no-ops (except the last allocation),
+  // all memory is freed at once on Reset; chunks of standard size
+  // are kept in thread-local cache for reuse
+  class TaskScratchArena
+  {
+  public:
+    TaskScratchArena() = default;
+    TaskScratchArena(TaskScratchArena const&) = delete;
+    TaskScratchArena& operator=(TaskScratchArena const&) = delete;
+    ~TaskScratchArena()
+    {
+      Reset();
+    }
+
+    void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t))
+    {
+      uintptr_t data = ((uintptr_t)_pCurrent + alignment - 1) & ~(uintptr_t)(alignment - 1);
+      if(!_pCurrent || size > (uintptr_t)_pEnd - data || data > (uintptr_t)_pEnd)
+      {
+        NewChunk(size + alignment);
+        data = ((uintptr_t)_pCurrent + alignment - 1) & ~(uintptr_t)(alignment - 1);
+      }
+      _pCurrent = (uint8_t*)(data + size);
+      return (void*)data;
+    }
+
+    // only the last allocation is actually freed
+    void Deallocate(void* data, size_t size)
+    {
+      if((uint8_t*)data + size == _pCurrent)
+        _pCurrent = (uint8_t*)data;
+    }
+
+    // free all memory
+    void Reset()
+    {
+      while(_pChunk)
+      {
+        Chunk* pPrev = _pChunk->pPrev;
+        FreeChunk(_pChunk);
+        _pChunk = pPrev;
+      }
+      _pCurrent = nullptr;
+      _pEnd = nullptr;
+    }
+
+  private:
+    struct alignas(std::max_align_t) Chunk
+    {
+      Chunk* pPrev;
+      size_t size;
+    };
+
+    void NewChunk(size_t minSize)
+    {
+      size_t size = std::max(_chunkSize, sizeof(Chunk) + minSize);
+      Chunk* pChunk = nullptr;
+      Cache* pCache = size == _chunkSize ? GetCache() : nullptr;
+      if(pCache && pCache->pHead)
+      {
+        pChunk = pCache->pHead;
+        pCache->pHead = pChunk->pPrev;
+        --pCache->count;
+      }
+      else
+        pChunk = static_cast<Chunk*>(::operator new(size));
+      pChunk->pPrev = _pChunk;
+      pChunk->size = size;
+      _pChunk = pChunk;
+      _pCurrent = (uint8_t*)(pChunk + 1);
+      _pEnd = (uint8_t*)pChunk + size;
+    }
+
+    static void FreeChunk(Chunk* pChunk)
+    {
+      Cache* pCache = pChunk->size == _chunkSize ? GetCache() : nullptr;
+      if(pCache && pCache->count < _maxCachedChunksCount)
+      {
+        pChunk->pPrev = pCache->pHead;
+        pCache->pHead = pChunk;
+        ++pCache->count;
+      }
+      else
+        ::operator delete(pChunk, pChunk->size);
+    }
+
+    struct Cache
+    {
+      ~Cache()
+      {
+        _tCacheDestroyed = true;
+        while(pHead)
+        {
+          Chunk* pPrev = pHead->pPrev;
+          ::operator delete(pHead, pHead->size);
+          pHead = pPrev;
+        }
+      }
+
+      Chunk* pHead = nullptr;
+      size_t count = 0;
+    };
+
+    // returns null if thread cache is already destroyed
+    static Cache* GetCache()
+    {
+      if(_tCacheDestroyed) return nullptr;
+      static thread_local Cache cache;
+      return &cache;
+    }
+
+    static constexpr size_t _chunkSize = 0x10000;
+    static constexpr size_t _maxCachedChunksCount = 8;
+
+    Chunk* _pChunk = nullptr;
+    uint8_t* _pCurrent = nullptr;
+    uint8_t* _pEnd = nullptr;
+
+    static inline thread_local bool _tCacheDestroyed = false;
+  };
+
+  // standard allocator over scratch arena
+  // usage: std::vector<T, TaskScratchAllocator<T>> v{co_await GetTaskScratchArena()};
+  template <typename T>
+  class TaskScratchAllocator
+  {
+  public:
+    using value_type = T;
+
+    TaskScratchAllocator(TaskScratchArena& arena)
+    : _pArena(&arena) {}
+    template <typename U>
+    TaskScratchAllocator(TaskScratchAllocator<U> const& other)
+    : _pArena(other._pArena) {}
+
+    T* allocate(size_t n)
+    {
+      if(n > std::numeric_limits<size_t>::max() / sizeof(T))
+        throw std::bad_alloc();
+      return static_cast<T*>(_pArena->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* data, size_t n)
+    {
+      _pArena->Deallocate(data, n * sizeof(T));
+    }
+
+    template <typename U>
+    friend bool operator==(TaskScratchAllocator const& a, TaskScratchAllocator<U> const& b)
+    {
+      return a._pArena == b._pArena;
+    }
+
+  private:
+    TaskScratchArena* _pArena;
+
+    template <typename U>
+    friend class TaskScratchAllocator;
+  };
+
+  // coroutine promise first base class
+  // result state lives in the promise, i.e. inside coroutine frame;
+  // frame is refcounted by the running coroutine and by task objects
+  class TaskPromiseBase1
+  {
+  public:
+    // coroutine frames are allocated from pool
+    static void* operator new(size_t size)
+    {
+      return TaskFrameAllocator::Allocate(size);
+    }
+    static void operator delete(void* data, size_t size)
+    {
+      TaskFrameAllocator::Deallocate(data, size);
+    }
+
+  protected:
+    // initial awaiter class
+    // queues task in the engine after initial suspend,
+    // so tasks always start in the thread pool
+    class InitialAwaiter
+    {
+    public:
+      bool await_ready() const
+      {
+        return false;
+      }
+      void await_suspend(std::coroutine_handle<> const& coroutine) const
+      {
+        TaskEngine::GetInstance().Queue(coroutine);
+      }
+      void await_resume() const
+      {
+      }
+    };
+
+    // final awaiter class
+    // releases coroutine's own reference after final suspend, and
+    // transfers control to the single continuation, if there's one
+    class FinalAwaiter
+    {
+    public:
+      bool await_ready() const noexcept
+      {
+        return false;
+      }
+      template <typename Promise>
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> coroutine) const noexcept
+      {
+        Promise& promise = coroutine.promise();
+        // locals are destroyed at this point, so scratch memory is not used anymore
+        static_cast<TaskPromiseBase1&>(promise)._scratchArena.Reset();
+        std::coroutine_handle<> continuation = static_cast<TaskPromiseBase1&>(promise)._continuation;
+        promise.Release();
+        return continuation ? continuation : std::noop_coroutine();
+      }
+      void await_resume() const noexcept
+      {
+      }
+    };
+
+    void AddRef()
+    {
+      _refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // returns true if it was the last reference
+    bool ReleaseRef()
+    {
+      return _refCount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    bool IsReady() const
+    {
+      return _state.load(std::memory_order_acquire) == ReadyState();
+    }
+
+    // add waiter to the list, returns false if result is already there
+    bool AddWaiter(TaskWaiter& waiter)
+    {
+      void* state = _state.load(std::memory_order_acquire);
+      do
+      {
+        if(state == ReadyState()) return false;
+        waiter.next = static_cast<TaskWaiter*>(state);
+      }
+      while(!_state.compare_exchange_weak(state, &waiter, std::memory_order_release, std::memory_order_acquire));
+      return true;
+    }
+
+    // mark result as set, and wake up waiters
+    // single waiter is remembered to be resumed inline after final suspend
+    void Complete()
+    {
+      void* state = _state.exchange(ReadyState(), std::memory_order_seq_cst);
+      if(_hasBlockingWaiters.load(std::memory_order_seq_cst))
+      {
+        _state.notify_all();
+        TaskEngine::GetInstance().WakeHelpers();
+      }
+
+      TaskWaiter* waiter = static_cast<TaskWaiter*>(state);
+      // single waiting coroutine with the same executor and priority is resumed inline
+      if(waiter && !waiter->next && !waiter->callback && waiter->pExecutor == &TaskExecutor::GetCurrent() && waiter->priority == TaskEngine::GetCurrentPriority())
+      {
+        _continuation = waiter->coroutine;
+        return;
+      }
+      while(waiter)
+      {
+        // read next pointer before resumed coroutine destroys the waiter
+        TaskWaiter* next = waiter->next;
+        if(waiter->callback)
+          waiter->callback(*waiter);
+        else
+          waiter->pExecutor->Queue(waiter->coroutine, waiter->priority);
+        waiter = next;
+      }
+    }
+
+    // block current thread until result is set
+    // runs queued coroutines meanwhile, if possible
+    void Wait()
+    {
+      if(IsReady()) return;
+      _hasBlockingWaiters.store(true, std::memory_order_seq_cst);
+      if(TaskEngine::GetInstance().HelpUntil([&]()
+      {
+        return _state.load(std::memory_order_seq_cst) == ReadyState();
+      })) return;
+      for(void* state; (state = _state.load(std::memory_order_seq_cst)) != ReadyState(); )
+        _state.wait(state, std::memory_order_acquire);
+    }
+
+  private:
+    // state is either null (not ready, no waiters), pointer to this (ready),
+    // or pointer to the list of waiters
+    void* ReadyState() const
+    {
+      return const_cast<TaskPromiseBase1*>(this);
+    }
+
+    std::atomic<void*> _state = nullptr;
+    // one reference for the running coroutine, one for the returned task
+    std::atomic<uint32_t> _refCount = 2;
+    std::atomic<bool> _hasBlockingWaiters = false;
+    // coroutine to resume inline after completion
+    std::coroutine_handle<> _continuation;
+    // scratch memory for the task, freed when it finishes
+    TaskScratchArena _scratchArena;
+
+    friend class GetTaskScratchArena;
+  };
+
+  // coroutine promise second base class
+  // implements everything except void/non-void distinction
+  template <typename R>
+  class TaskPromiseBase2 : public TaskPromiseBase1
+  {
+  public:
+    InitialAwaiter initial_suspend()
+    {
+      return {};
+    }
+    FinalAwaiter final_suspend() noexcept
+    {
+      return {};
+    }
+
+    Task<R> get_return_object()
+    {
+      return Task<R>(GetCoroutine());
+    }
+
+    void unhandled_exception()
+    {
+      _result.template emplace<std::exception_ptr>(std::current_exception());
+      Complete();
+    }
+
+  protected:
+    struct Void {};
+    using Value = std::conditional_t<std::same_as<R, void>, Void, R>;
+
+    void SetValue(Value const& value)
+    {
+      _result.template emplace<Value>(value);
+      Complete();
+    }
+    void SetValue(Value&& value)
+    {
+      _result.template emplace<Value>(std::move(value));
+      Complete();
+    }
+
+    // destroy frame if it was the last reference
+    void Release()
+    {
+      if(ReleaseRef())
+        GetCoroutine().destroy();
+    }
+
+    R GetResult() const
+    {
+      // return value or rethrow exception
+      if(std::exception_ptr const* pException = std::get_if<std::exception_ptr>(&_result))
+        std::rethrow_exception(*pException);
+      if constexpr(!std::same_as<R, void>)
+      {
+        return std::get<Value>(_result);
+      }
+    }
+
+    // wait for result
+    R Get()
+    {
+      Wait();
+      return GetResult();
+    }
+
+    // task awaiter class
+    // holds waiter node, so awaiting does not allocate
+    class ResultAwaiter
+    {
+    public:
+      ResultAwaiter(TaskPromiseBase2& promise)
+      : _promise(promise) {}
+
+      bool await_ready() const
+      {
+        return _promise.IsReady();
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        // resume immediately if result is already there
+        return _promise.AddWaiter(_waiter) ? std::noop_coroutine() : coroutine;
+      }
+
+      R await_resume() const
+      {
+        return _promise.GetResult();
+      }
+
+    private:
+      TaskPromiseBase2& _promise;
+      TaskWaiter _waiter;
+    };
+
+  private:
+    std::coroutine_handle<TaskPromise<R>> GetCoroutine()
+    {
+      return std::coroutine_handle<TaskPromise<R>>::from_promise(static_cast<TaskPromise<R>&>(*this));
+    }
+
+    std::variant<std::monostate, Value, std::exception_ptr> _result;
+
+    friend class TaskPromiseBase1;
+    friend class Task<R>;
+  };
+
+  // non-void task promise class
+  template <typename R>
+  class TaskPromise : public TaskPromiseBase2<R>
+  {
+  public:
+    void return_value(R const& value)
+    {
+      this->SetValue(value);
+    }
+    void return_value(R&& value)
+    {
+      this->SetValue(std::move(value));
+    }
+  };
+  // void task promise class
+  template <>
+  class TaskPromise<void> : public TaskPromiseBase2<void>
+  {
+  public:
+    void return_void()
+    {
+      this->SetValue({});
     }
   };
 
   // task class
-  // just wraps shared_ptr to result class
+  // refcounted reference to coroutine frame holding the result
   template <typename R>
   class Task
   {
@@ -343,24 +1802,463 @@ export namespace Coil
     using promise_type = TaskPromise<R>;
 
     Task() = delete;
+    Task(Task const& other)
+    : _coroutine(other._coroutine)
+    {
+      _coroutine.promise().AddRef();
+    }
+    Task(Task&& other) noexcept
+    : _coroutine(std::exchange(other._coroutine, nullptr)) {}
+    ~Task()
+    {
+      if(_coroutine)
+        _coroutine.promise().Release();
+    }
+
+    Task& operator=(Task const& other)
+    {
+      if(this != &other)
+      {
+        Task task = other;
+        std::swap(_coroutine, task._coroutine);
+      }
+      return *this;
+    }
+    Task& operator=(Task&& other) noexcept
+    {
+      std::swap(_coroutine, other._coroutine);
+      return *this;
+    }
 
     typename TaskPromise<R>::ResultAwaiter operator co_await() const
     {
-      return _pResult;
+      return _coroutine.promise();
     }
 
     // block and wait for result
     R Get() const
     {
-      return _pResult->Get();
+      return _coroutine.promise().Get();
+    }
+
+    // whether result is already set
+    bool IsReady() const
+    {
+      return _coroutine.promise().IsReady();
+    }
+
+    // subscribe for completion, for implementing custom awaiters
+    // waiter must be kept alive until notified
+    // returns false if result is already set
+    bool AddWaiter(TaskWaiter& waiter) const
+    {
+      return _coroutine.promise().AddWaiter(waiter);
     }
 
   private:
-    explicit Task(std::shared_ptr<typename TaskPromise<R>::Result> const& pResult)
-    : _pResult(pResult) {}
+    explicit Task(std::coroutine_handle<TaskPromise<R>> coroutine)
+    : _coroutine(coroutine) {}
 
-    std::shared_ptr<typename TaskPromise<R>::Result> _pResult;
+    std::coroutine_handle<TaskPromise<R>> _coroutine;
 
     friend class TaskPromiseBase2<R>;
   };
+
+  // awaiter returning scratch arena of the current task, without suspending
+  // usable only in task coroutines; memory must not escape the task,
+  // as it is freed when the task finishes
+  class GetTaskScratchArena
+  {
+  public:
+    bool await_ready() const
+    {
+      return false;
+    }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> coroutine)
+    {
+      static_assert(std::derived_from<Promise, TaskPromiseBase1>, "scratch arena is only available in tasks");
+      _pArena = &static_cast<TaskPromiseBase1&>(coroutine.promise())._scratchArena;
+      return false;
+    }
+
+    TaskScratchArena& await_resume() const
+    {
+      return *_pArena;
+    }
+
+  private:
+    TaskScratchArena* _pArena = nullptr;
+  };
+
+  // result type of WhenAll for single task
+  template <typename R>
+  using WhenAllResult = std::conditional_t<std::same_as<R, void>, std::monostate, R>;
+
+  // awaiter for waiting all of the tasks
+  // join state lives in the awaiter, parent is resumed once
+  template <typename... R>
+  class WhenAllAwaiter
+  {
+  public:
+    WhenAllAwaiter(Task<R> const&... tasks)
+    : _tasks(tasks...) {}
+
+    bool await_ready() const
+    {
+      return std::apply([](Task<R> const&... tasks)
+      {
+        return (tasks.IsReady() && ...);
+      }, _tasks);
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      _coroutine = coroutine;
+      _pExecutor = &TaskExecutor::GetCurrent();
+      _priority = TaskEngine::GetCurrentPriority();
+      [&]<size_t... i>(std::index_sequence<i...>)
+      {
+        (Subscribe(std::get<i>(_tasks), _nodes[i]), ...);
+      }(std::index_sequence_for<R...>());
+      // release registration's count; suspend if not everything is done
+      return _pendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    std::tuple<WhenAllResult<R>...> await_resume() const
+    {
+      return std::apply([](Task<R> const&... tasks)
+      {
+        return std::tuple<WhenAllResult<R>...>{GetResult(tasks)...};
+      }, _tasks);
+    }
+
+  private:
+    struct Node : public TaskWaiter
+    {
+      WhenAllAwaiter* pAwaiter = nullptr;
+    };
+
+    template <typename T>
+    void Subscribe(Task<T> const& task, Node& node)
+    {
+      node.pAwaiter = this;
+      node.callback = &OnCompleted;
+      if(!task.AddWaiter(node))
+        _pendingCount.fetch_sub(1, std::memory_order_acq_rel);
+    }
+
+    static void OnCompleted(TaskWaiter& waiter)
+    {
+      WhenAllAwaiter* pAwaiter = static_cast<Node&>(waiter).pAwaiter;
+      if(pAwaiter->_pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pAwaiter->_pExecutor->Queue(pAwaiter->_coroutine, pAwaiter->_priority);
+    }
+
+    template <typename T>
+    static WhenAllResult<T> GetResult(Task<T> const& task)
+    {
+      if constexpr(std::same_as<T, void>)
+      {
+        task.Get();
+        return {};
+      }
+      else
+      {
+        return task.Get();
+      }
+    }
+
+    std::tuple<Task<R> const&...> _tasks;
+    Node _nodes[sizeof...(R)];
+    // one count per task, plus one for registration
+    std::atomic<size_t> _pendingCount = sizeof...(R) + 1;
+    std::coroutine_handle<> _coroutine;
+    TaskExecutor* _pExecutor = nullptr;
+    TaskPriority _priority = TaskPriority::Normal;
+  };
+
+  // awaiter for waiting all tasks in a range
+  template <typename R>
+  class WhenAllRangeAwaiter
+  {
+  public:
+    WhenAllRangeAwaiter(std::span<Task<R> const> tasks)
+    : _tasks(tasks) {}
+
+    bool await_ready() const
+    {
+      for(size_t i = 0; i < _tasks.size(); ++i)
+        if(!_tasks[i].IsReady()) return false;
+      return true;
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      _coroutine = coroutine;
+      _pExecutor = &TaskExecutor::GetCurrent();
+      _priority = TaskEngine::GetCurrentPriority();
+      _pendingCount.store(_tasks.size() + 1, std::memory_order_relaxed);
+      _nodes = std::make_unique<Node[]>(_tasks.size());
+      for(size_t i = 0; i < _tasks.size(); ++i)
+      {
+        _nodes[i].pAwaiter = this;
+        _nodes[i].callback = &OnCompleted;
+        if(!_tasks[i].AddWaiter(_nodes[i]))
+          _pendingCount.fetch_sub(1, std::memory_order_acq_rel);
+      }
+      // release registration's count; suspend if not everything is done
+      return _pendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    auto await_resume() const
+    {
+      if constexpr(std::same_as<R, void>)
+      {
+        for(size_t i = 0; i < _tasks.size(); ++i)
+          _tasks[i].Get();
+      }
+      else
+      {
+        std::vector<R> results;
+        results.reserve(_tasks.size());
+        for(size_t i = 0; i < _tasks.size(); ++i)
+          results.push_back(_tasks[i].Get());
+        return results;
+      }
+    }
+
+  private:
+    struct Node : public TaskWaiter
+    {
+      WhenAllRangeAwaiter* pAwaiter = nullptr;
+    };
+
+    static void OnCompleted(TaskWaiter& waiter)
+    {
+      WhenAllRangeAwaiter* pAwaiter = static_cast<Node&>(waiter).pAwaiter;
+      if(pAwaiter->_pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        pAwaiter->_pExecutor->Queue(pAwaiter->_coroutine, pAwaiter->_priority);
+    }
+
+    std::span<Task<R> const> _tasks;
+    // single allocation for all nodes
+    std::unique_ptr<Node[]> _nodes;
+    std::atomic<size_t> _pendingCount = 0;
+    std::coroutine_handle<> _coroutine;
+    TaskExecutor* _pExecutor = nullptr;
+    TaskPriority _priority = TaskPriority::Normal;
+  };
+
+  // join state for WhenAny
+  // allocated once together with waiter nodes, and outlives the awaiter,
+  // as tasks still reference it after parent is resumed
+  class WhenAnyState
+  {
+  public:
+    struct Node : public TaskWaiter
+    {
+      WhenAnyState* pState = nullptr;
+      size_t index = 0;
+    };
+
+    static WhenAnyState* Create(size_t nodesCount, std::coroutine_handle<> coroutine, TaskExecutor& executor, TaskPriority priority)
+    {
+      void* data = ::operator new(sizeof(WhenAnyState) + nodesCount * sizeof(Node));
+      WhenAnyState* pState = new (data) WhenAnyState();
+      pState->_coroutine = coroutine;
+      pState->_pExecutor = &executor;
+      pState->_priority = priority;
+      // one reference per node plus one for the awaiter
+      pState->_refCount.store(nodesCount + 1, std::memory_order_relaxed);
+      pState->_nodes = reinterpret_cast<Node*>(pState + 1);
+      pState->_nodesCount = nodesCount;
+      for(size_t i = 0; i < nodesCount; ++i)
+      {
+        Node* pNode = new (pState->_nodes + i) Node();
+        pNode->pState = pState;
+        pNode->index = i;
+        pNode->callback = &OnCompleted;
+      }
+      return pState;
+    }
+
+    Node& GetNode(size_t i)
+    {
+      return _nodes[i];
+    }
+
+    size_t GetWinnerIndex() const
+    {
+      return _winnerIndex.load(std::memory_order_acquire);
+    }
+
+    // returns true if parent should be resumed by the caller
+    bool FinishRegistration()
+    {
+      return _pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    static void OnCompleted(TaskWaiter& waiter)
+    {
+      Node& node = static_cast<Node&>(waiter);
+      WhenAnyState* pState = node.pState;
+      size_t expected = -1;
+      if(pState->_winnerIndex.compare_exchange_strong(expected, node.index, std::memory_order_acq_rel))
+      {
+        if(pState->_pendingCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+          pState->_pExecutor->Queue(pState->_coroutine, pState->_priority);
+      }
+      pState->Release();
+    }
+
+    void Release()
+    {
+      if(_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        for(size_t i = 0; i < _nodesCount; ++i)
+          _nodes[i].~Node();
+        this->~WhenAnyState();
+        ::operator delete(this);
+      }
+    }
+
+  private:
+    WhenAnyState() = default;
+
+    std::coroutine_handle<> _coroutine;
+    TaskExecutor* _pExecutor = nullptr;
+    TaskPriority _priority = TaskPriority::Normal;
+    std::atomic<size_t> _winnerIndex = -1;
+    // first completion and registration; the last one resumes parent
+    std::atomic<size_t> _pendingCount = 2;
+    std::atomic<size_t> _refCount = 0;
+    Node* _nodes = nullptr;
+    size_t _nodesCount = 0;
+  };
+
+  // awaiter for waiting any of the tasks, returns index of the first completed task
+  // tasks is either tuple of task references, or span of tasks
+  template <typename Tasks>
+  class WhenAnyAwaiter
+  {
+  public:
+    WhenAnyAwaiter(Tasks tasks)
+    : _tasks(tasks) {}
+
+    bool await_ready()
+    {
+      // empty range is reported as index equal to tasks count
+      _index = GetTasksCount();
+      if(_index == 0) return true;
+      for(size_t i = 0; i < GetTasksCount(); ++i)
+      {
+        if(VisitTask(i, [](auto const& task) { return task.IsReady(); }))
+        {
+          _index = i;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      size_t tasksCount = GetTasksCount();
+      _pState = WhenAnyState::Create(tasksCount, coroutine, TaskExecutor::GetCurrent(), TaskEngine::GetCurrentPriority());
+      for(size_t i = 0; i < tasksCount; ++i)
+      {
+        WhenAnyState::Node& node = _pState->GetNode(i);
+        if(!VisitTask(i, [&](auto const& task) { return task.AddWaiter(node); }))
+        {
+          // already completed, no need to register the rest
+          WhenAnyState::OnCompleted(node);
+          for(size_t j = i + 1; j < tasksCount; ++j)
+            _pState->Release();
+          break;
+        }
+      }
+      // suspend if nothing is done yet
+      return !_pState->FinishRegistration();
+    }
+
+    size_t await_resume()
+    {
+      if(_pState)
+      {
+        _index = _pState->GetWinnerIndex();
+        std::exchange(_pState, nullptr)->Release();
+      }
+      return _index;
+    }
+
+  private:
+    size_t GetTasksCount() const
+    {
+      if constexpr(requires { _tasks.size(); })
+        return _tasks.size();
+      else
+        return std::tuple_size_v<Tasks>;
+    }
+
+    template <typename F>
+    bool VisitTask(size_t i, F const& f) const
+    {
+      if constexpr(requires { _tasks.size(); })
+        return f(_tasks[i]);
+      else
+        return [&]<size_t... j>(std::index_sequence<j...>)
+        {
+          bool result = false;
+          ((j == i ? (result = f(std::get<j>(_tasks)), true) : false) || ...);
+          return result;
+        }(std::make_index_sequence<std::tuple_size_v<Tasks>>());
+    }
+
+    Tasks _tasks;
+    WhenAnyState* _pState = nullptr;
+    size_t _index = 0;
+  };
+
+  // wait for all tasks, return tuple of results
+  // void results are represented by std::monostate
+  // exception of the first failed task (in order of arguments) is rethrown
+  template <typename... R>
+  WhenAllAwaiter<R...> WhenAll(Task<R> const&... tasks)
+  {
+    static_assert(sizeof...(R) > 0);
+    return { tasks... };
+  }
+
+  // wait for all tasks in range, return vector of results (nothing for void tasks)
+  template <typename R>
+  WhenAllRangeAwaiter<R> WhenAll(std::span<Task<R> const> tasks)
+  {
+    return { tasks };
+  }
+  template <typename R>
+  WhenAllRangeAwaiter<R> WhenAll(std::vector<Task<R>> const& tasks)
+  {
+    return { std::span<Task<R> const>{tasks} };
+  }
+
+  // wait for any of the tasks, return index of the first completed task
+  // other tasks continue running; get result by awaiting the task
+  template <typename... R>
+  WhenAnyAwaiter<std::tuple<Task<R> const&...>> WhenAny(Task<R> const&... tasks)
+  {
+    static_assert(sizeof...(R) > 0);
+    return { std::tuple<Task<R> const&...>{tasks...} };
+  }
+  template <typename R>
+  WhenAnyAwaiter<std::span<Task<R> const>> WhenAny(std::span<Task<R> const> tasks)
+  {
+    return { tasks };
+  }
+  template <typename R>
+  WhenAnyAwaiter<std::span<Task<R> const>> WhenAny(std::vector<Task<R>> const& tasks)
+  {
+    return { std::span<Task<R> const>{tasks} };
+  }
 }
@@ -0,0 +1,278 @@
+module;
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <exception>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+export module coil.core.tasks.blocking;
+
+import coil.core.tasks;
+import coil.core.time;
+
+export namespace Coil
+{
+  // job for blocking pool
+  // stored by the submitting side (usually in awaiter), so submitting does not allocate
+  struct TaskBlockingJob
+  {
+    TaskBlockingJob* next = nullptr;
+    // function to run in pool thread
+    void (*run)(TaskBlockingJob&) = nullptr;
+    // time of queueing, for metrics
+    Time::Tick queuedTick = 0;
+  };
+
+  // blocking pool counters
+  struct TaskBlockingPoolStats
+  {
+    // jobs started
+    uint64_t jobsCount = 0;
+    // total time jobs spent in queue before starting, in ticks
+    Time::Tick queueDelayTicks = 0;
+    // max time job spent in queue, in ticks
+    Time::Tick maxQueueDelayTicks = 0;
+    // current and max number of threads
+    uint32_t threadsCount = 0;
+    uint32_t peakThreadsCount = 0;
+  };
+
+  // elastic thread pool for blocking calls (sqlite, image decoding, process spawning, etc),
+  // so they do not pin task engine workers
+  // threads are started on demand up to the limit, and exit after staying idle for a while
+  class TaskBlockingPool
+  {
+  private:
+    TaskBlockingPool() = default;
+
+    ~TaskBlockingPool()
+    {
+      {
+        std::unique_lock lock{_mutex};
+        _stopping = true;
+      }
+      _cv.notify_all();
+      for(auto& thread : _threads)
+        thread.thread.join();
+    }
+
+  public:
+    static TaskBlockingPool& GetInstance()
+    {
+      static TaskBlockingPool instance;
+      return instance;
+    }
+
+    // queue job to be run in pool thread
+    void Post(TaskBlockingJob& job)
+    {
+      job.next = nullptr;
+      job.queuedTick = Time::GetTick();
+      {
+        std::unique_lock lock{_mutex};
+        if(_pTail)
+          _pTail->next = &job;
+        else
+          _pHead = &job;
+        _pTail = &job;
+        ++_queuedCount;
+
+        // start new thread if all threads are busy
+        if(_queuedCount > _idleThreadsCount && _threadsCount < _maxThreadsCount)
+          StartThread();
+      }
+      _cv.notify_one();
+    }
+
+    // limit number of threads
+    void SetMaxThreadsCount(uint32_t maxThreadsCount)
+    {
+      std::unique_lock lock{_mutex};
+      _maxThreadsCount = std::max<uint32_t>(maxThreadsCount, 1);
+    }
+
+    uint32_t GetMaxThreadsCount() const
+    {
+      std::unique_lock lock{_mutex};
+      return _maxThreadsCount;
+    }
+
+    TaskBlockingPoolStats GetStats() const
+    {
+      std::unique_lock lock{_mutex};
+      TaskBlockingPoolStats stats = _stats;
+      stats.threadsCount = _threadsCount;
+      return stats;
+    }
+
+    void ResetStats()
+    {
+      std::unique_lock lock{_mutex};
+      _stats = {};
+      _stats.peakThreadsCount = _threadsCount;
+    }
+
+  private:
+    struct Thread
+    {
+      std::thread thread;
+      bool finished = false;
+    };
+
+    // called under lock
+    void StartThread()
+    {
+      // join threads which exited
+      for(auto i = _threads.begin(); i != _threads.end(); )
+      {
+        if(i->finished)
+        {
+          i->thread.join();
+          i = _threads.erase(i);
+        }
+        else ++i;
+      }
+
+      ++_threadsCount;
+      _stats.peakThreadsCount = std::max(_stats.peakThreadsCount, _threadsCount);
+      Thread& thread = _threads.emplace_back();
+      thread.thread = std::thread([this, &thread]()
+      {
+        Run(thread);
+      });
+    }
+
+    void Run(Thread& thread)
+    {
+      std::unique_lock lock{_mutex};
+      for(;;)
+      {
+        if(!_pHead)
+        {
+          if(_stopping) break;
+          ++_idleThreadsCount;
+          bool woken = _cv.wait_for(lock, _idleTimeout, [&]()
+          {
+            return _pHead || _stopping;
+          });
+          --_idleThreadsCount;
+          // exit if stayed idle for too long
+          if(!woken) break;
+          continue;
+        }
+
+        TaskBlockingJob* pJob = _pHead;
+        _pHead = pJob->next;
+        if(!_pHead) _pTail = nullptr;
+        --_queuedCount;
+
+        Time::Tick queueDelay = Time::GetTick() - pJob->queuedTick;
+        ++_stats.jobsCount;
+        _stats.queueDelayTicks += queueDelay;
+        _stats.maxQueueDelayTicks = std::max(_stats.maxQueueDelayTicks, queueDelay);
+
+        lock.unlock();
+        pJob->run(*pJob);
+        lock.lock();
+      }
+      --_threadsCount;
+      thread.finished = true;
+    }
+
+    static constexpr std::chrono::seconds _idleTimeout{10};
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    TaskBlockingJob* _pHead = nullptr;
+    TaskBlockingJob* _pTail = nullptr;
+    size_t _queuedCount = 0;
+    // threads are referenced by themselves, so list is used
+    std::list<Thread> _threads;
+    uint32_t _threadsCount = 0;
+    uint32_t _idleThreadsCount = 0;
+    uint32_t _maxThreadsCount = 64;
+    bool _stopping = false;
+    TaskBlockingPoolStats _stats;
+  };
+
+  // awaiter running function in blocking pool
+  // calling coroutine is resumed on its executor with the result
+  template <typename F>
+  class RunBlockingAwaiter
+  {
+  public:
+    using Result = std::invoke_result_t<F&>;
+
+    RunBlockingAwaiter(F&& f)
+    : _f(std::move(f)) {}
+
+    bool await_ready() const
+    {
+      return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+      _job.run = &Run;
+      _job.pAwaiter = this;
+      _waiter.coroutine = coroutine;
+      _waiter.pExecutor = &TaskExecutor::GetCurrent();
+      _waiter.priority = TaskEngine::GetCurrentPriority();
+      TaskBlockingPool::GetInstance().Post(_job);
+    }
+
+    Result await_resume()
+    {
+      if(_exception)
+        std::rethrow_exception(_exception);
+      if constexpr(!std::is_void_v<Result>)
+        return std::move(_result.value());
+    }
+
+  private:
+    struct Job : public TaskBlockingJob
+    {
+      RunBlockingAwaiter* pAwaiter = nullptr;
+    };
+
+    static void Run(TaskBlockingJob& job)
+    {
+      RunBlockingAwaiter& awaiter = *static_cast<Job&>(job).pAwaiter;
+      try
+      {
+        if constexpr(std::is_void_v<Result>)
+          awaiter._f();
+        else
+          awaiter._result.emplace(awaiter._f());
+      }
+      catch(...)
+      {
+        awaiter._exception = std::current_exception();
+      }
+      awaiter._waiter.pExecutor->Queue(awaiter._waiter.coroutine, awaiter._waiter.priority);
+    }
+
+    F _f;
+    Job _job;
+    TaskWaiter _waiter;
+    std::conditional_t<std::is_void_v<Result>, std::monostate, std::optional<Result>> _result;
+    std::exception_ptr _exception;
+  };
+
+  // run blocking function in blocking pool, without pinning task engine worker
+  // usage: auto result = co_await RunBlocking([&]() { return blockingCall(); });
+  template <typename F>
+  RunBlockingAwaiter<std::decay_t<F>> RunBlocking(F&& f)
+  {
+    return std::decay_t<F>(std::forward<F>(f));
+  }
+}
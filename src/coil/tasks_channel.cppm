@@ -0,0 +1,430 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <span>
+#include <utility>
+
+export module coil.core.tasks.channel;
+
+import coil.core.tasks;
+
+export namespace Coil
+{
+  // bounded multi-producer multi-consumer channel for tasks
+  // values are stored in lock-free ring (Vyukov's bounded queue);
+  // senders suspend only when channel is full, receivers only when it's empty.
+  // Waiters are stored in awaiters; when there are waiters, the other side
+  // completes their operation on their behalf and resumes them.
+  // Closed channel does not accept values, but still can be drained.
+  template <typename T>
+  class Channel
+  {
+  private:
+    struct SendWaiter : public TaskWaiter
+    {
+      T* pValue = nullptr;
+      bool sent = false;
+    };
+
+    struct ReceiveWaiter : public TaskWaiter
+    {
+      std::optional<T> value;
+    };
+
+  public:
+    // capacity is rounded up to power of two (and at least 2), as required by the ring,
+    // so the channel may buffer more values than requested; see GetCapacity
+    Channel(size_t capacity)
+    : _mask(std::bit_ceil(std::max<size_t>(capacity, 2)) - 1), _cells(std::make_unique<Cell[]>(_mask + 1))
+    {
+      for(size_t i = 0; i <= _mask; ++i)
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    ~Channel()
+    {
+      std::optional<T> value;
+      while(TryPop(value)) {}
+    }
+
+    Channel(Channel const&) = delete;
+    Channel& operator=(Channel const&) = delete;
+
+    class SendAwaiter
+    {
+    public:
+      SendAwaiter(Channel& channel, T&& value)
+      : _channel{channel}, _value{std::move(value)} {}
+
+      bool await_ready()
+      {
+        if(_channel._closed.load(std::memory_order_acquire)) return true;
+        _waiter.sent = _channel.TryPush(_value);
+        if(_waiter.sent) _channel.AfterPush();
+        return _waiter.sent;
+      }
+
+      bool await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        _waiter.pValue = &_value;
+        return _channel.AddSender(_waiter);
+      }
+
+      // returns false if channel is closed and value was not sent
+      bool await_resume() const
+      {
+        return _waiter.sent;
+      }
+
+    private:
+      Channel& _channel;
+      T _value;
+      SendWaiter _waiter;
+    };
+
+    class ReceiveAwaiter
+    {
+    public:
+      ReceiveAwaiter(Channel& channel)
+      : _channel{channel} {}
+
+      bool await_ready()
+      {
+        if(_channel.TryPop(_waiter.value))
+        {
+          _channel.AfterPop();
+          return true;
+        }
+        if(_channel._closed.load(std::memory_order_acquire))
+        {
+          // value might have been sent right before closing
+          if(_channel.TryPop(_waiter.value))
+            _channel.AfterPop();
+          return true;
+        }
+        return false;
+      }
+
+      bool await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        return _channel.AddReceiver(_waiter);
+      }
+
+      // returns nullopt if channel is closed and empty
+      std::optional<T> await_resume()
+      {
+        return std::move(_waiter.value);
+      }
+
+    private:
+      Channel& _channel;
+      ReceiveWaiter _waiter;
+    };
+
+    // send value, waiting while channel is full
+    // returns false if channel is closed
+    SendAwaiter Send(T value)
+    {
+      return { *this, std::move(value) };
+    }
+
+    // receive value, waiting while channel is empty
+    // returns nullopt if channel is closed and empty
+    ReceiveAwaiter Receive()
+    {
+      return *this;
+    }
+
+    // send value if there's space, without waiting
+    // value is moved out only if sent
+    bool TrySend(T& value)
+    {
+      if(_closed.load(std::memory_order_acquire) || !TryPush(value)) return false;
+      AfterPush();
+      return true;
+    }
+
+    // receive value if there's any, without waiting
+    std::optional<T> TryReceive()
+    {
+      std::optional<T> value;
+      if(TryPop(value))
+        AfterPop();
+      return value;
+    }
+
+    // send values in order, waiting only when channel is full
+    // returns number of values sent, less than total if channel is closed
+    Task<size_t> SendMany(std::span<T> values)
+    {
+      for(size_t i = 0; i < values.size(); ++i)
+      {
+        if(TrySend(values[i])) continue;
+        if(!co_await Send(std::move(values[i])))
+          co_return i;
+      }
+      co_return values.size();
+    }
+
+    // receive at least one value, and then as many as available without waiting
+    // returns number of values received, 0 if channel is closed and empty
+    Task<size_t> ReceiveMany(std::span<T> values)
+    {
+      if(values.empty()) co_return 0;
+      std::optional<T> value = co_await Receive();
+      if(!value) co_return 0;
+      values[0] = std::move(*value);
+      size_t count = 1;
+      for(; count < values.size(); ++count)
+      {
+        value = TryReceive();
+        if(!value) break;
+        values[count] = std::move(*value);
+      }
+      co_return count;
+    }
+
+    // stop accepting values, and wake up all waiters
+    // waiting senders get false, receivers get remaining values and then nullopt
+    void Close()
+    {
+      TaskWaiter* waiters = nullptr;
+      {
+        std::unique_lock lock{_mutex};
+        _closed.store(true, std::memory_order_release);
+        Pump(waiters);
+        while(_pReceiversHead)
+          AppendWaiter(waiters, PopWaiter(_pReceiversHead, _pReceiversTail, _receiversCount));
+        while(_pSendersHead)
+          AppendWaiter(waiters, PopWaiter(_pSendersHead, _pSendersTail, _sendersCount));
+      }
+      ResumeWaiters(waiters);
+    }
+
+    bool IsClosed() const
+    {
+      return _closed.load(std::memory_order_acquire);
+    }
+
+    // actual capacity, after rounding up
+    size_t GetCapacity() const
+    {
+      return _mask + 1;
+    }
+
+  private:
+    struct Cell
+    {
+      std::atomic<size_t> sequence;
+      alignas(T) uint8_t storage[sizeof(T)];
+    };
+
+    // push value into ring, returns false if it's full
+    bool TryPush(T& value)
+    {
+      size_t pos = _enqueuePos.load(std::memory_order_relaxed);
+      Cell* cell;
+      for(;;)
+      {
+        cell = &_cells[pos & _mask];
+        intptr_t diff = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)pos;
+        if(diff == 0)
+        {
+          if(_enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if(diff < 0)
+          return false;
+        else
+          pos = _enqueuePos.load(std::memory_order_relaxed);
+      }
+      new (cell->storage) T(std::move(value));
+      cell->sequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    // pop value from ring, returns false if it's empty
+    bool TryPop(std::optional<T>& value)
+    {
+      size_t pos = _dequeuePos.load(std::memory_order_relaxed);
+      Cell* cell;
+      for(;;)
+      {
+        cell = &_cells[pos & _mask];
+        intptr_t diff = (intptr_t)cell->sequence.load(std::memory_order_acquire) - (intptr_t)(pos + 1);
+        if(diff == 0)
+        {
+          if(_dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            break;
+        }
+        else if(diff < 0)
+          return false;
+        else
+          pos = _dequeuePos.load(std::memory_order_relaxed);
+      }
+      T* pValue = std::launder(reinterpret_cast<T*>(cell->storage));
+      value.emplace(std::move(*pValue));
+      pValue->~T();
+      cell->sequence.store(pos + _mask + 1, std::memory_order_release);
+      return true;
+    }
+
+    // wake up receivers after pushing a value
+    void AfterPush()
+    {
+      // either receiver sees the value, or we see the receiver
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(_receiversCount.load(std::memory_order_relaxed) > 0)
+        PumpAndResume();
+    }
+
+    // wake up senders after popping a value
+    void AfterPop()
+    {
+      // either sender sees the free cell, or we see the sender
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(_sendersCount.load(std::memory_order_relaxed) > 0)
+        PumpAndResume();
+    }
+
+    // sends value and returns false if possible, otherwise adds waiter and returns true
+    bool AddSender(SendWaiter& waiter)
+    {
+      {
+        std::unique_lock lock{_mutex};
+        if(_closed.load(std::memory_order_relaxed)) return false;
+        _sendersCount.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!TryPush(*waiter.pValue))
+        {
+          PushWaiter(_pSendersHead, _pSendersTail, waiter);
+          return true;
+        }
+        _sendersCount.fetch_sub(1, std::memory_order_relaxed);
+      }
+      waiter.sent = true;
+      AfterPush();
+      return false;
+    }
+
+    // receives value and returns false if possible, otherwise adds waiter and returns true
+    bool AddReceiver(ReceiveWaiter& waiter)
+    {
+      {
+        std::unique_lock lock{_mutex};
+        _receiversCount.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if(!TryPop(waiter.value))
+        {
+          if(_closed.load(std::memory_order_relaxed))
+          {
+            _receiversCount.fetch_sub(1, std::memory_order_relaxed);
+            return false;
+          }
+          PushWaiter(_pReceiversHead, _pReceiversTail, waiter);
+          return true;
+        }
+        _receiversCount.fetch_sub(1, std::memory_order_relaxed);
+      }
+      AfterPop();
+      return false;
+    }
+
+    void PumpAndResume()
+    {
+      TaskWaiter* waiters = nullptr;
+      {
+        std::unique_lock lock{_mutex};
+        Pump(waiters);
+      }
+      ResumeWaiters(waiters);
+    }
+
+    // complete operations of waiters while possible, must be called under mutex
+    // completed waiters are added to the list
+    void Pump(TaskWaiter*& waiters)
+    {
+      for(bool progress = true; progress; )
+      {
+        progress = false;
+        while(_pReceiversHead && TryPop(static_cast<ReceiveWaiter*>(_pReceiversHead)->value))
+        {
+          AppendWaiter(waiters, PopWaiter(_pReceiversHead, _pReceiversTail, _receiversCount));
+          progress = true;
+        }
+        while(_pSendersHead && TryPush(*static_cast<SendWaiter*>(_pSendersHead)->pValue))
+        {
+          static_cast<SendWaiter*>(_pSendersHead)->sent = true;
+          AppendWaiter(waiters, PopWaiter(_pSendersHead, _pSendersTail, _sendersCount));
+          progress = true;
+        }
+      }
+    }
+
+    static void PushWaiter(TaskWaiter*& pHead, TaskWaiter*& pTail, TaskWaiter& waiter)
+    {
+      waiter.next = nullptr;
+      if(pTail)
+        pTail->next = &waiter;
+      else
+        pHead = &waiter;
+      pTail = &waiter;
+    }
+
+    static TaskWaiter* PopWaiter(TaskWaiter*& pHead, TaskWaiter*& pTail, std::atomic<size_t>& count)
+    {
+      TaskWaiter* waiter = pHead;
+      pHead = waiter->next;
+      if(!pHead) pTail = nullptr;
+      count.fetch_sub(1, std::memory_order_relaxed);
+      return waiter;
+    }
+
+    // order of resuming does not matter, so add to the front
+    static void AppendWaiter(TaskWaiter*& waiters, TaskWaiter* waiter)
+    {
+      waiter->next = waiters;
+      waiters = waiter;
+    }
+
+    static void ResumeWaiters(TaskWaiter* waiters)
+    {
+      while(waiters)
+      {
+        // read next pointer before resumed coroutine destroys the waiter
+        TaskWaiter* next = waiters->next;
+        waiters->pExecutor->Queue(waiters->coroutine, waiters->priority);
+        waiters = next;
+      }
+    }
+
+    size_t const _mask;
+    std::unique_ptr<Cell[]> _cells;
+    alignas(64) std::atomic<size_t> _enqueuePos = 0;
+    alignas(64) std::atomic<size_t> _dequeuePos = 0;
+    alignas(64) std::atomic<bool> _closed = false;
+    // numbers of waiters, for checking without mutex
+    std::atomic<size_t> _sendersCount = 0;
+    std::atomic<size_t> _receiversCount = 0;
+    // protects queues of waiters
+    std::mutex _mutex;
+    TaskWaiter* _pSendersHead = nullptr;
+    TaskWaiter* _pSendersTail = nullptr;
+    TaskWaiter* _pReceiversHead = nullptr;
+    TaskWaiter* _pReceiversTail = nullptr;
+  };
+}
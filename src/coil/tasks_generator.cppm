@@ -0,0 +1,187 @@
+module;
+
+#include <concepts>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+export module coil.core.tasks.generator;
+
+import coil.core.tasks;
+
+export namespace Coil
+{
+  // asynchronous generator coroutine, can both co_await and co_yield
+  // generator is lazy: it runs only while consumer awaits next value,
+  // and suspends on every yield until next value is requested,
+  // so producer never runs ahead of consumer.
+  // Generator runs inline in consumer's thread; if it gets resumed
+  // somewhere else (after co_await), consumer is resumed on its own executor.
+  // Single consumer only.
+  template <typename T>
+  class [[nodiscard]] AsyncGenerator
+  {
+  public:
+    class promise_type
+    {
+    public:
+      // coroutine frames are allocated from pool
+      static void* operator new(size_t size)
+      {
+        return TaskFrameAllocator::Allocate(size);
+      }
+      static void operator delete(void* data, size_t size)
+      {
+        TaskFrameAllocator::Deallocate(data, size);
+      }
+
+      // awaiter switching back to consumer on yield and on finish
+      class SwitchAwaiter
+      {
+      public:
+        bool await_ready() const noexcept
+        {
+          return false;
+        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> coroutine) const noexcept
+        {
+          TaskWaiter& consumer = *coroutine.promise()._pConsumer;
+          // resume consumer inline if it's the same executor and priority
+          if(consumer.pExecutor == &TaskExecutor::GetCurrent() && consumer.priority == TaskEngine::GetCurrentPriority())
+            return consumer.coroutine;
+          consumer.pExecutor->Queue(consumer.coroutine, consumer.priority);
+          return std::noop_coroutine();
+        }
+        void await_resume() const noexcept
+        {
+        }
+      };
+
+      AsyncGenerator get_return_object()
+      {
+        return std::coroutine_handle<promise_type>::from_promise(*this);
+      }
+      std::suspend_always initial_suspend()
+      {
+        return {};
+      }
+      SwitchAwaiter final_suspend() noexcept
+      {
+        return {};
+      }
+      SwitchAwaiter yield_value(T const& value)
+      {
+        _value.emplace(value);
+        return {};
+      }
+      SwitchAwaiter yield_value(T&& value)
+      {
+        _value.emplace(std::move(value));
+        return {};
+      }
+      void return_void()
+      {
+      }
+      void unhandled_exception()
+      {
+        _exception = std::current_exception();
+      }
+
+    private:
+      std::optional<T> _value;
+      std::exception_ptr _exception;
+      // waiter of currently awaiting consumer
+      TaskWaiter* _pConsumer = nullptr;
+
+      friend AsyncGenerator;
+    };
+
+    // awaiter for the next value
+    // holds waiter node, so awaiting does not allocate
+    class NextAwaiter
+    {
+    public:
+      NextAwaiter(std::coroutine_handle<promise_type> coroutine)
+      : _coroutine(coroutine) {}
+
+      bool await_ready() const
+      {
+        return !_coroutine || _coroutine.done();
+      }
+
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        promise_type& promise = _coroutine.promise();
+        promise._pConsumer = &_waiter;
+        // run generator until next yield
+        return _coroutine;
+      }
+
+      // returns empty optional when generator is finished
+      std::optional<T> await_resume()
+      {
+        if(!_coroutine) return {};
+        promise_type& promise = _coroutine.promise();
+        if(promise._exception)
+          std::rethrow_exception(std::exchange(promise._exception, nullptr));
+        return std::exchange(promise._value, std::nullopt);
+      }
+
+    private:
+      std::coroutine_handle<promise_type> _coroutine;
+      TaskWaiter _waiter;
+    };
+
+    AsyncGenerator(AsyncGenerator const&) = delete;
+    AsyncGenerator(AsyncGenerator&& other) noexcept
+    : _coroutine(std::exchange(other._coroutine, nullptr)) {}
+    AsyncGenerator& operator=(AsyncGenerator const&) = delete;
+    AsyncGenerator& operator=(AsyncGenerator&& other) noexcept
+    {
+      std::swap(_coroutine, other._coroutine);
+      return *this;
+    }
+
+    // generator must not be running
+    ~AsyncGenerator()
+    {
+      if(_coroutine)
+        _coroutine.destroy();
+    }
+
+    // get next value
+    // co_await returns empty optional when generator is finished,
+    // and rethrows exception thrown by generator
+    NextAwaiter Next() const
+    {
+      return _coroutine;
+    }
+
+  private:
+    AsyncGenerator(std::coroutine_handle<promise_type> coroutine)
+    : _coroutine(coroutine) {}
+
+    std::coroutine_handle<promise_type> _coroutine;
+  };
+
+  // call function for every value of generator
+  // function may return task, which is awaited before requesting next value
+  template <typename T, typename F>
+  Task<void> ForEach(AsyncGenerator<T> generator, F f)
+  {
+    for(;;)
+    {
+      std::optional<T> value = co_await generator.Next();
+      if(!value.has_value()) break;
+      if constexpr(std::same_as<std::invoke_result_t<F&, T&&>, Task<void>>)
+        co_await f(std::move(value.value()));
+      else
+        f(std::move(value.value()));
+    }
+  }
+}
@@ -0,0 +1,937 @@
+module;
+
+#include "base.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+#if defined(COIL_PLATFORM_POSIX)
+#include <cerrno>
+#include <climits>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#if defined(COIL_PLATFORM_LINUX)
+#include <unordered_map>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+#if defined(COIL_PLATFORM_LINUX) && __has_include(<linux/io_uring.h>)
+#define COIL_TASKS_IO_URING
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+export module coil.core.tasks.io;
+
+import coil.core.base;
+import coil.core.tasks;
+import coil.core.tasks.blocking;
+
+#if defined(COIL_PLATFORM_POSIX)
+
+export namespace Coil
+{
+  struct TaskIoBatch;
+
+  // asynchronous file I/O operation
+  // stored by the waiting side (usually in awaiter), so submitting does not allocate;
+  // waiter is notified when operation completes
+  struct TaskIoOperation : public TaskWaiter
+  {
+    enum class Type : uint8_t
+    {
+      Read,
+      Write,
+    };
+
+    Type type = Type::Read;
+    int fd = -1;
+    uint64_t offset = 0;
+    iovec const* iovecs = nullptr;
+    uint32_t iovecsCount = 0;
+    // number of bytes transferred, or negative errno
+    int64_t result = 0;
+    // if set, batch is notified instead when all its operations complete
+    TaskIoBatch* pBatch = nullptr;
+    // ring bookkeeping: pointer to link pointing to this operation in list of in-flight ones
+    TaskWaiter** ppPrevInFlight = nullptr;
+  };
+
+  // group of operations completing together
+  struct TaskIoBatch : public TaskWaiter
+  {
+    std::atomic<size_t> pendingCount = 0;
+  };
+
+  // singleton class performing file I/O asynchronously
+  // uses io_uring on Linux, with single thread submitting operations
+  // in batches and reaping completions; falls back to blocking I/O
+  // in blocking pool if io_uring is not available
+  class TaskIo
+  {
+  private:
+    TaskIo()
+    {
+      // make sure engine outlives us, as completions are queued there
+      TaskEngine::GetInstance();
+      // make sure blocking pool outlives us; it's used even with io_uring,
+      // in case the ring fails
+      TaskBlockingPool::GetInstance();
+      for(size_t i = 0; i < _fallbackJobsCount; ++i)
+      {
+        _fallbackJobs[i].run = &RunFallback;
+        _fallbackJobs[i].pIo = this;
+      }
+
+#if defined(COIL_TASKS_IO_URING)
+      if(InitRing())
+      {
+        _threads.emplace_back([this]()
+        {
+          RunRing();
+        });
+      }
+#endif
+    }
+
+    ~TaskIo()
+    {
+      _stopping.store(true, std::memory_order_relaxed);
+      // ring thread cancels and waits for in-flight operations
+#if defined(COIL_TASKS_IO_URING)
+      if(_ringFd >= 0)
+      {
+        uint64_t one = 1;
+        (void)::write(_eventFd, &one, sizeof(one));
+      }
+#endif
+      for(size_t i = 0; i < _threads.size(); ++i)
+        _threads[i].join();
+      // wait for fallback jobs to finish
+      {
+        std::unique_lock lock{_fallbackMutex};
+        _fallbackCv.wait(lock, [&]()
+        {
+          for(size_t i = 0; i < _fallbackJobsCount; ++i)
+            if(_fallbackJobs[i].active) return false;
+          return true;
+        });
+      }
+#if defined(COIL_TASKS_IO_URING)
+      if(_ringFd >= 0)
+      {
+        if(_pSqes) ::munmap(_pSqes, _sqesSize);
+        if(_pCqRing && _pCqRing != _pSqRing) ::munmap(_pCqRing, _cqRingSize);
+        if(_pSqRing) ::munmap(_pSqRing, _sqRingSize);
+        ::close(_ringFd);
+      }
+      if(_eventFd >= 0)
+        ::close(_eventFd);
+#endif
+    }
+
+  public:
+    class OperationAwaiter
+    {
+    public:
+      OperationAwaiter(TaskIoOperation::Type type, int fd, uint64_t offset, void* data, size_t size)
+      {
+        _iovec.iov_base = data;
+        _iovec.iov_len = std::min<size_t>(size, std::numeric_limits<ssize_t>::max());
+        _operation.type = type;
+        _operation.fd = fd;
+        _operation.offset = offset;
+        _operation.iovecs = &_iovec;
+        _operation.iovecsCount = 1;
+      }
+      OperationAwaiter(TaskIoOperation::Type type, int fd, uint64_t offset, iovec const* iovecs, uint32_t iovecsCount)
+      {
+        _operation.type = type;
+        _operation.fd = fd;
+        _operation.offset = offset;
+        _operation.iovecs = iovecs;
+        _operation.iovecsCount = std::min<uint32_t>(iovecsCount, IOV_MAX);
+      }
+
+      bool await_ready() const
+      {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _operation.coroutine = coroutine;
+        _operation.pExecutor = &TaskExecutor::GetCurrent();
+        _operation.priority = TaskEngine::GetCurrentPriority();
+        TaskIo::GetInstance().Submit(_operation);
+      }
+
+      // returns number of bytes transferred, or negative errno
+      int64_t await_resume() const
+      {
+        return _operation.result;
+      }
+
+    private:
+      iovec _iovec;
+      TaskIoOperation _operation;
+    };
+
+    // read from file at offset, possibly less than requested
+    static OperationAwaiter Read(int fd, uint64_t offset, void* data, size_t size)
+    {
+      return { TaskIoOperation::Type::Read, fd, offset, data, size };
+    }
+
+    // write to file at offset, possibly less than requested
+    static OperationAwaiter Write(int fd, uint64_t offset, void const* data, size_t size)
+    {
+      return { TaskIoOperation::Type::Write, fd, offset, const_cast<void*>(data), size };
+    }
+
+    // read from file at offset into multiple buffers, possibly less than requested
+    // iovecs must be kept alive until completion
+    static OperationAwaiter ReadVector(int fd, uint64_t offset, iovec const* iovecs, uint32_t iovecsCount)
+    {
+      return { TaskIoOperation::Type::Read, fd, offset, iovecs, iovecsCount };
+    }
+
+    // awaiter for batch of operations, submitted at once
+    class BatchAwaiter
+    {
+    public:
+      BatchAwaiter(std::span<TaskIoOperation> operations)
+      : _operations{operations} {}
+
+      bool await_ready() const
+      {
+        return _operations.empty();
+      }
+
+      void await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _batch.coroutine = coroutine;
+        _batch.pExecutor = &TaskExecutor::GetCurrent();
+        _batch.priority = TaskEngine::GetCurrentPriority();
+        _batch.pendingCount.store(_operations.size(), std::memory_order_relaxed);
+        for(size_t i = 0; i < _operations.size(); ++i)
+        {
+          _operations[i].pBatch = &_batch;
+          _operations[i].next = i + 1 < _operations.size() ? &_operations[i + 1] : nullptr;
+        }
+        TaskIo::GetInstance().Submit(_operations[0]);
+      }
+
+      // results are in operations
+      void await_resume() const
+      {
+      }
+
+    private:
+      std::span<TaskIoOperation> _operations;
+      TaskIoBatch _batch;
+    };
+
+    // submit operations at once, and wait for all of them
+    static BatchAwaiter SubmitBatch(std::span<TaskIoOperation> operations)
+    {
+      return operations;
+    }
+
+    // submit operations linked by next pointers
+    // every operation's waiter is notified when it's completed
+    void Submit(TaskIoOperation& operation)
+    {
+#if defined(COIL_TASKS_IO_URING)
+      if(_ringFd >= 0)
+      {
+        TaskIoOperation* pLast = &operation;
+        while(pLast->next)
+          pLast = static_cast<TaskIoOperation*>(pLast->next);
+        TaskWaiter* pHead = _pPendingOperations.load(std::memory_order_relaxed);
+        do
+        {
+          // ring thread has stopped, use fallback
+          if(pHead == &_ringClosed) break;
+          pLast->next = pHead;
+        }
+        while(!_pPendingOperations.compare_exchange_weak(pHead, &operation, std::memory_order_release, std::memory_order_relaxed));
+        if(pHead != &_ringClosed)
+        {
+          // wake up ring thread if there was nothing pending
+          if(!pHead)
+          {
+            uint64_t one = 1;
+            (void)::write(_eventFd, &one, sizeof(one));
+          }
+          return;
+        }
+        pLast->next = nullptr;
+      }
+#endif
+
+      SubmitFallback(operation);
+    }
+
+    // whether io_uring is used
+    bool IsUsingIoUring() const
+    {
+#if defined(COIL_TASKS_IO_URING)
+      return _ringFd >= 0 && _pPendingOperations.load(std::memory_order_relaxed) != &_ringClosed;
+#else
+      return false;
+#endif
+    }
+
+    static TaskIo& GetInstance()
+    {
+      static TaskIo instance;
+      return instance;
+    }
+
+  private:
+    // queue operations linked by next pointers, and start fallback jobs in blocking pool
+    void SubmitFallback(TaskIoOperation& operation)
+    {
+      FallbackJob* pJobsToPost[_fallbackJobsCount];
+      size_t jobsToPostCount = 0;
+      {
+        std::unique_lock lock{_fallbackMutex};
+        size_t operationsCount = 0;
+        for(TaskWaiter* pOperation = &operation; pOperation; ++operationsCount)
+        {
+          TaskWaiter* pNext = pOperation->next;
+          pOperation->next = nullptr;
+          if(_pFallbackTail)
+            _pFallbackTail->next = pOperation;
+          else
+            _pFallbackHead = pOperation;
+          _pFallbackTail = pOperation;
+          pOperation = pNext;
+        }
+        for(size_t i = 0; i < _fallbackJobsCount && jobsToPostCount < operationsCount; ++i)
+          if(!_fallbackJobs[i].active)
+          {
+            _fallbackJobs[i].active = true;
+            pJobsToPost[jobsToPostCount++] = &_fallbackJobs[i];
+          }
+      }
+      for(size_t i = 0; i < jobsToPostCount; ++i)
+        TaskBlockingPool::GetInstance().Post(*pJobsToPost[i]);
+    }
+
+    static void Complete(TaskIoOperation& operation, int64_t result)
+    {
+      operation.result = result;
+      TaskWaiter* pWaiter = &operation;
+      if(operation.pBatch)
+      {
+        if(operation.pBatch->pendingCount.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        pWaiter = operation.pBatch;
+      }
+      if(pWaiter->callback)
+        pWaiter->callback(*pWaiter);
+      else
+        pWaiter->pExecutor->Queue(pWaiter->coroutine, pWaiter->priority);
+    }
+
+    // perform operation with blocking I/O
+    static int64_t Perform(TaskIoOperation const& operation)
+    {
+      ssize_t result = operation.type == TaskIoOperation::Type::Read
+        ? ::preadv(operation.fd, operation.iovecs, operation.iovecsCount, operation.offset)
+        : ::pwritev(operation.fd, operation.iovecs, operation.iovecsCount, operation.offset);
+      return result >= 0 ? result : -errno;
+    }
+
+    // fallback job in blocking pool, performs queued operations until queue is empty
+    static void RunFallback(TaskBlockingJob& job)
+    {
+      FallbackJob& fallbackJob = static_cast<FallbackJob&>(job);
+      TaskIo& io = *fallbackJob.pIo;
+      for(;;)
+      {
+        TaskIoOperation* pOperation;
+        {
+          std::unique_lock lock{io._fallbackMutex};
+          if(!io._pFallbackHead)
+          {
+            fallbackJob.active = false;
+            if(io._stopping.load(std::memory_order_relaxed))
+              io._fallbackCv.notify_all();
+            return;
+          }
+          pOperation = static_cast<TaskIoOperation*>(io._pFallbackHead);
+          io._pFallbackHead = pOperation->next;
+          if(!io._pFallbackHead) io._pFallbackTail = nullptr;
+        }
+        Complete(*pOperation, Perform(*pOperation));
+      }
+    }
+
+#if defined(COIL_TASKS_IO_URING)
+    bool InitRing()
+    {
+      _eventFd = ::eventfd(0, EFD_CLOEXEC);
+      if(_eventFd < 0) return false;
+
+      io_uring_params params = {};
+      _ringFd = (int)::syscall(__NR_io_uring_setup, _ringEntriesCount, &params);
+      if(_ringFd < 0) return false;
+
+      _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+      _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+      bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+      if(singleMmap)
+        _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+      _pSqRing = Map(_sqRingSize, IORING_OFF_SQ_RING);
+      if(!_pSqRing) return CloseRing();
+      _pCqRing = singleMmap ? _pSqRing : Map(_cqRingSize, IORING_OFF_CQ_RING);
+      if(!_pCqRing) return CloseRing();
+      _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+      _pSqes = (io_uring_sqe*)Map(_sqesSize, IORING_OFF_SQES);
+      if(!_pSqes) return CloseRing();
+
+      uint8_t* pSqRing = (uint8_t*)_pSqRing;
+      uint8_t* pCqRing = (uint8_t*)_pCqRing;
+      _pSqHead = (uint32_t*)(pSqRing + params.sq_off.head);
+      _pSqTail = (uint32_t*)(pSqRing + params.sq_off.tail);
+      _sqMask = *(uint32_t*)(pSqRing + params.sq_off.ring_mask);
+      _sqEntriesCount = params.sq_entries;
+      _pSqArray = (uint32_t*)(pSqRing + params.sq_off.array);
+      _pCqHead = (uint32_t*)(pCqRing + params.cq_off.head);
+      _pCqTail = (uint32_t*)(pCqRing + params.cq_off.tail);
+      _cqMask = *(uint32_t*)(pCqRing + params.cq_off.ring_mask);
+      _pCqes = (io_uring_cqe*)(pCqRing + params.cq_off.cqes);
+      // keep completions from overflowing, reserving one for wakeup
+      _maxInFlightCount = params.cq_entries - 1;
+
+      return true;
+    }
+
+    void* Map(size_t size, uint64_t offset)
+    {
+      void* pMapping = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, offset);
+      return pMapping == MAP_FAILED ? nullptr : pMapping;
+    }
+
+    // returns false for convenience
+    bool CloseRing()
+    {
+      if(_pSqes) ::munmap(_pSqes, _sqesSize);
+      if(_pCqRing && _pCqRing != _pSqRing) ::munmap(_pCqRing, _cqRingSize);
+      if(_pSqRing) ::munmap(_pSqRing, _sqRingSize);
+      _pSqes = nullptr;
+      _pCqRing = nullptr;
+      _pSqRing = nullptr;
+      ::close(_ringFd);
+      _ringFd = -1;
+      return false;
+    }
+
+    // get next submission queue entry, or null if queue is full
+    io_uring_sqe* GetSqe()
+    {
+      uint32_t tail = *_pSqTail;
+      if(tail - std::atomic_ref<uint32_t>(*_pSqHead).load(std::memory_order_acquire) >= _sqEntriesCount)
+        return nullptr;
+      uint32_t index = tail & _sqMask;
+      io_uring_sqe* pSqe = &_pSqes[index];
+      std::memset(pSqe, 0, sizeof(*pSqe));
+      _pSqArray[index] = index;
+      return pSqe;
+    }
+
+    void PushSqe()
+    {
+      std::atomic_ref<uint32_t>(*_pSqTail).store(*_pSqTail + 1, std::memory_order_release);
+      ++_toSubmitCount;
+    }
+
+    void RunRing()
+    {
+      // operations not yet submitted, in FIFO order
+      TaskWaiter* pBacklogHead = nullptr;
+      TaskWaiter** ppBacklogTail = &pBacklogHead;
+
+      while(!_stopping.load(std::memory_order_relaxed))
+      {
+        // poll for eventfd to be woken up on new operations
+        if(!_wakeupArmed)
+        {
+          if(io_uring_sqe* pSqe = GetSqe())
+          {
+            pSqe->opcode = IORING_OP_POLL_ADD;
+            pSqe->fd = _eventFd;
+            pSqe->poll32_events = POLLIN;
+            pSqe->user_data = _wakeupUserData;
+            PushSqe();
+            _wakeupArmed = true;
+          }
+        }
+
+        // take new operations
+        *ppBacklogTail = TakePendingOperations(nullptr);
+        while(*ppBacklogTail)
+          ppBacklogTail = &(*ppBacklogTail)->next;
+
+        // submit operations as long as there's space
+        while(pBacklogHead && _inFlightCount < _maxInFlightCount)
+        {
+          io_uring_sqe* pSqe = GetSqe();
+          if(!pSqe) break;
+          TaskIoOperation* pOperation = static_cast<TaskIoOperation*>(pBacklogHead);
+          pBacklogHead = pBacklogHead->next;
+          if(!pBacklogHead) ppBacklogTail = &pBacklogHead;
+
+          pSqe->opcode = pOperation->type == TaskIoOperation::Type::Read ? IORING_OP_READV : IORING_OP_WRITEV;
+          pSqe->fd = pOperation->fd;
+          pSqe->off = pOperation->offset;
+          pSqe->addr = (uint64_t)pOperation->iovecs;
+          pSqe->len = pOperation->iovecsCount;
+          pSqe->user_data = (uint64_t)pOperation;
+          PushSqe();
+          LinkInFlight(*pOperation);
+        }
+
+        // submit and wait for at least one completion; wakeup poll is always armed
+        // (or being submitted), so waiting is safe
+        if(int error = Enter())
+        {
+          // ring is broken: fail in-flight operations, and switch to fallback
+          // for everything else, including operations submitted later
+          Reap();
+          FailInFlight(error);
+          *ppBacklogTail = TakePendingOperations(&_ringClosed);
+          if(pBacklogHead)
+            SubmitFallback(*static_cast<TaskIoOperation*>(pBacklogHead));
+          return;
+        }
+        Reap();
+      }
+
+      // stopping: operations not submitted yet are cancelled, and no more are accepted
+      *ppBacklogTail = TakePendingOperations(&_ringClosed);
+      while(pBacklogHead)
+      {
+        TaskWaiter* pNext = pBacklogHead->next;
+        Complete(*static_cast<TaskIoOperation*>(pBacklogHead), -ECANCELED);
+        pBacklogHead = pNext;
+      }
+
+      // try to cancel in-flight operations, and wait for them, so their coroutines are resumed
+#if defined(IORING_ASYNC_CANCEL_ANY)
+      if(_pInFlight)
+      {
+        if(io_uring_sqe* pSqe = GetSqe())
+        {
+          pSqe->opcode = IORING_OP_ASYNC_CANCEL;
+          pSqe->fd = -1;
+          pSqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+          pSqe->user_data = _cancelUserData;
+          PushSqe();
+        }
+      }
+#endif
+      while(_pInFlight)
+      {
+        if(int error = Enter())
+        {
+          Reap();
+          FailInFlight(error);
+          break;
+        }
+        Reap();
+      }
+    }
+
+    // take operations submitted by other threads, in FIFO order, replacing them with new head
+    TaskWaiter* TakePendingOperations(TaskWaiter* pNewHead)
+    {
+      TaskWaiter* pNew = _pPendingOperations.exchange(pNewHead, std::memory_order_acquire);
+      TaskWaiter* pReversed = nullptr;
+      while(pNew)
+      {
+        TaskWaiter* pNext = pNew->next;
+        pNew->next = pReversed;
+        pReversed = pNew;
+        pNew = pNext;
+      }
+      return pReversed;
+    }
+
+    // submit queued entries and wait for at least one completion
+    // returns 0, or errno if the ring cannot be used anymore
+    int Enter()
+    {
+      for(;;)
+      {
+        int submittedCount = (int)::syscall(__NR_io_uring_enter, _ringFd, _toSubmitCount, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if(submittedCount >= 0)
+        {
+          _toSubmitCount -= submittedCount;
+          return 0;
+        }
+        int error = errno;
+        // interrupted, or completion queue needs reaping; both are transient
+        if(error == EINTR)
+          continue;
+        if(error == EAGAIN || error == EBUSY)
+          return 0;
+        return error;
+      }
+    }
+
+    // process completions
+    void Reap()
+    {
+      uint32_t head = *_pCqHead;
+      uint32_t tail = std::atomic_ref<uint32_t>(*_pCqTail).load(std::memory_order_acquire);
+      for(; head != tail; ++head)
+      {
+        io_uring_cqe const& cqe = _pCqes[head & _cqMask];
+        if(cqe.user_data == _wakeupUserData)
+        {
+          // poll may also be cancelled, then eventfd is not readable
+          if(cqe.res > 0)
+          {
+            uint64_t value;
+            (void)::read(_eventFd, &value, sizeof(value));
+          }
+          _wakeupArmed = false;
+        }
+        else if(cqe.user_data != _cancelUserData)
+        {
+          TaskIoOperation& operation = *(TaskIoOperation*)cqe.user_data;
+          UnlinkInFlight(operation);
+          Complete(operation, cqe.res);
+        }
+      }
+      std::atomic_ref<uint32_t>(*_pCqHead).store(head, std::memory_order_release);
+    }
+
+    void LinkInFlight(TaskIoOperation& operation)
+    {
+      operation.next = _pInFlight;
+      if(_pInFlight)
+        static_cast<TaskIoOperation*>(_pInFlight)->ppPrevInFlight = &operation.next;
+      operation.ppPrevInFlight = &_pInFlight;
+      _pInFlight = &operation;
+      ++_inFlightCount;
+    }
+
+    void UnlinkInFlight(TaskIoOperation& operation)
+    {
+      *operation.ppPrevInFlight = operation.next;
+      if(operation.next)
+        static_cast<TaskIoOperation*>(operation.next)->ppPrevInFlight = operation.ppPrevInFlight;
+      operation.next = nullptr;
+      operation.ppPrevInFlight = nullptr;
+      --_inFlightCount;
+    }
+
+    // complete in-flight operations with error, when ring cannot deliver their completions
+    void FailInFlight(int error)
+    {
+      while(_pInFlight)
+      {
+        TaskIoOperation& operation = *static_cast<TaskIoOperation*>(_pInFlight);
+        UnlinkInFlight(operation);
+        Complete(operation, -error);
+      }
+    }
+#endif
+
+    std::atomic<bool> _stopping = false;
+    std::vector<std::thread> _threads;
+
+    // blocking I/O fallback
+    // operations are performed by jobs in blocking pool, limited number at a time
+    struct FallbackJob : public TaskBlockingJob
+    {
+      TaskIo* pIo = nullptr;
+      // guarded by fallback mutex
+      bool active = false;
+    };
+    static constexpr size_t _fallbackJobsCount = 4;
+    FallbackJob _fallbackJobs[_fallbackJobsCount];
+    std::mutex _fallbackMutex;
+    std::condition_variable _fallbackCv;
+    TaskWaiter* _pFallbackHead = nullptr;
+    TaskWaiter* _pFallbackTail = nullptr;
+
+#if defined(COIL_TASKS_IO_URING)
+    static constexpr uint32_t _ringEntriesCount = 256;
+    int _ringFd = -1;
+    // eventfd for waking up ring thread
+    int _eventFd = -1;
+    // operations submitted by other threads, in LIFO order
+    // points to _ringClosed when ring thread does not accept operations anymore
+    std::atomic<TaskWaiter*> _pPendingOperations = nullptr;
+    TaskWaiter _ringClosed;
+    // user data of internal entries; operations use their addresses
+    static constexpr uint64_t _wakeupUserData = 0;
+    static constexpr uint64_t _cancelUserData = 1;
+
+    void* _pSqRing = nullptr;
+    void* _pCqRing = nullptr;
+    io_uring_sqe* _pSqes = nullptr;
+    size_t _sqRingSize = 0;
+    size_t _cqRingSize = 0;
+    size_t _sqesSize = 0;
+    uint32_t* _pSqHead = nullptr;
+    uint32_t* _pSqTail = nullptr;
+    uint32_t* _pSqArray = nullptr;
+    uint32_t _sqMask = 0;
+    uint32_t _sqEntriesCount = 0;
+    uint32_t* _pCqHead = nullptr;
+    uint32_t* _pCqTail = nullptr;
+    io_uring_cqe* _pCqes = nullptr;
+    uint32_t _cqMask = 0;
+
+    // accessed by ring thread only
+    uint32_t _toSubmitCount = 0;
+    uint32_t _inFlightCount = 0;
+    uint32_t _maxInFlightCount = 0;
+    // submitted operations, linked by next pointers
+    TaskWaiter* _pInFlight = nullptr;
+    bool _wakeupArmed = false;
+#endif
+  };
+
+#if defined(COIL_PLATFORM_LINUX)
+  // singleton class waiting for readiness of file descriptors
+  // (pipes, sockets, eventfd, timerfd, etc) with epoll
+  // single thread waits for all descriptors, and resumes
+  // waiting coroutines on their executors
+  class TaskReactor
+  {
+  private:
+    TaskReactor()
+    {
+      // make sure engine outlives us, as coroutines are queued there
+      TaskEngine::GetInstance();
+
+      _epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+      if(_epollFd < 0)
+        throw Exception("creating epoll failed");
+      _eventFd = ::eventfd(0, EFD_CLOEXEC);
+      if(_eventFd < 0)
+        throw Exception("creating eventfd failed");
+      epoll_event event =
+      {
+        .events = EPOLLIN,
+        .data = { .fd = _eventFd },
+      };
+      if(::epoll_ctl(_epollFd, EPOLL_CTL_ADD, _eventFd, &event) != 0)
+        throw Exception("adding eventfd to epoll failed");
+
+      _thread = std::thread([this]()
+      {
+        Run();
+      });
+    }
+
+    ~TaskReactor()
+    {
+      _stopping.store(true, std::memory_order_relaxed);
+      uint64_t one = 1;
+      (void)::write(_eventFd, &one, sizeof(one));
+      _thread.join();
+      ::close(_eventFd);
+      ::close(_epollFd);
+    }
+
+    struct Waiter : public TaskWaiter
+    {
+      int fd = -1;
+      uint32_t events = 0;
+      uint32_t result = 0;
+    };
+
+  public:
+    enum Events : uint32_t
+    {
+      Readable = 1,
+      Writable = 2,
+      // error or hang up, always reported
+      Error = 4,
+    };
+
+    class WaitAwaiter
+    {
+    public:
+      WaitAwaiter(int fd, uint32_t events)
+      {
+        _waiter.fd = fd;
+        _waiter.events = events;
+      }
+
+      bool await_ready() const
+      {
+        return false;
+      }
+
+      void await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        TaskReactor::GetInstance().AddWaiter(_waiter);
+      }
+
+      // returns events happened
+      uint32_t await_resume() const
+      {
+        return _waiter.result;
+      }
+
+    private:
+      Waiter _waiter;
+    };
+
+    // wait until descriptor is ready for any of specified events
+    static WaitAwaiter Wait(int fd, uint32_t events)
+    {
+      return { fd, events };
+    }
+    static WaitAwaiter WaitReadable(int fd)
+    {
+      return { fd, Readable };
+    }
+    static WaitAwaiter WaitWritable(int fd)
+    {
+      return { fd, Writable };
+    }
+
+    static TaskReactor& GetInstance()
+    {
+      static TaskReactor instance;
+      return instance;
+    }
+
+  private:
+    void AddWaiter(Waiter& waiter)
+    {
+      std::unique_lock lock{_mutex};
+      TaskWaiter*& pWaiters = _waiters[waiter.fd];
+      waiter.next = pWaiters;
+      pWaiters = &waiter;
+      if(!Arm(waiter.fd, pWaiters))
+      {
+        // cannot wait for descriptor, report error right away
+        pWaiters = waiter.next;
+        if(!pWaiters) _waiters.erase(waiter.fd);
+        lock.unlock();
+        waiter.result = Error;
+        waiter.pExecutor->Queue(waiter.coroutine, waiter.priority);
+      }
+    }
+
+    // register descriptor for events of all its waiters (oneshot)
+    bool Arm(int fd, TaskWaiter* pWaiters)
+    {
+      epoll_event event =
+      {
+        .events = EPOLLONESHOT,
+        .data = { .fd = fd },
+      };
+      for(TaskWaiter* pWaiter = pWaiters; pWaiter; pWaiter = pWaiter->next)
+      {
+        uint32_t events = static_cast<Waiter*>(pWaiter)->events;
+        if(events & Readable) event.events |= EPOLLIN;
+        if(events & Writable) event.events |= EPOLLOUT;
+      }
+      // descriptor may still be registered from previous waits
+      if(::epoll_ctl(_epollFd, EPOLL_CTL_MOD, fd, &event) == 0) return true;
+      return errno == ENOENT && ::epoll_ctl(_epollFd, EPOLL_CTL_ADD, fd, &event) == 0;
+    }
+
+    void Run()
+    {
+      epoll_event events[64];
+      while(!_stopping.load(std::memory_order_relaxed))
+      {
+        int eventsCount = ::epoll_wait(_epollFd, events, sizeof(events) / sizeof(events[0]), -1);
+        for(int i = 0; i < eventsCount; ++i)
+        {
+          int fd = events[i].data.fd;
+          if(fd == _eventFd)
+          {
+            uint64_t value;
+            (void)::read(_eventFd, &value, sizeof(value));
+            continue;
+          }
+
+          uint32_t happened = 0;
+          if(events[i].events & EPOLLIN) happened |= Readable;
+          if(events[i].events & EPOLLOUT) happened |= Writable;
+          if(events[i].events & (EPOLLERR | EPOLLHUP)) happened |= Error | Readable | Writable;
+
+          // take waiters interested in happened events
+          TaskWaiter* pReady = nullptr;
+          {
+            std::unique_lock lock{_mutex};
+            auto it = _waiters.find(fd);
+            if(it == _waiters.end()) continue;
+            TaskWaiter** ppWaiter = &it->second;
+            while(*ppWaiter)
+            {
+              Waiter* pWaiter = static_cast<Waiter*>(*ppWaiter);
+              if(pWaiter->events & happened)
+              {
+                *ppWaiter = pWaiter->next;
+                pWaiter->result = happened & (pWaiter->events | Error);
+                pWaiter->next = pReady;
+                pReady = pWaiter;
+              }
+              else
+                ppWaiter = &pWaiter->next;
+            }
+            // re-arm for remaining waiters
+            if(it->second)
+              Arm(fd, it->second);
+            else
+              _waiters.erase(it);
+          }
+
+          while(pReady)
+          {
+            // read next pointer before resumed coroutine destroys the waiter
+            TaskWaiter* pNext = pReady->next;
+            pReady->pExecutor->Queue(pReady->coroutine, pReady->priority);
+            pReady = pNext;
+          }
+        }
+      }
+    }
+
+    int _epollFd = -1;
+    // eventfd for waking up the thread
+    int _eventFd = -1;
+    std::thread _thread;
+    std::atomic<bool> _stopping = false;
+    // protects waiters
+    std::mutex _mutex;
+    // waiters per descriptor
+    std::unordered_map<int, TaskWaiter*> _waiters;
+  };
+#endif
+}
+
+#endif
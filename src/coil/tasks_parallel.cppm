@@ -0,0 +1,137 @@
+module;
+
+#include <algorithm>
+#include <concepts>
+#include <cstdint>
+#include <exception>
+#include <ranges>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+export module coil.core.tasks.parallel;
+
+import coil.core.base;
+import coil.core.tasks;
+
+namespace Coil
+{
+  // choose grain size if not specified: several chunks per worker thread
+  size_t GetParallelGrain(size_t count, size_t grain)
+  {
+    if(grain) return grain;
+    size_t const chunksPerThread = 8;
+    size_t threadsCount = std::max<size_t>(TaskEngine::GetInstance().GetThreadsCount(), 1);
+    return std::max<size_t>(count / (threadsCount * chunksPerThread), 1);
+  }
+
+  // range is split in halves until it's not bigger than grain;
+  // right halves are queued as separate tasks, so idle workers can steal them,
+  // while left half is split further and processed by the current one
+  // function is passed by reference, it is owned by the top-level task
+  template <typename F>
+  Task<void> ParallelForRange(size_t begin, size_t end, size_t grain, F& f)
+  {
+    std::vector<Task<void>> rights;
+    while(end - begin > grain)
+    {
+      size_t middle = begin + (end - begin) / 2;
+      rights.push_back(ParallelForRange(middle, end, grain, f));
+      end = middle;
+    }
+
+    std::exception_ptr exception;
+    try
+    {
+      for(size_t i = begin; i < end; ++i)
+        f(i);
+    }
+    catch(...)
+    {
+      exception = std::current_exception();
+    }
+    // wait for right halves even if left one fails, as they reference the function
+    co_await WhenAll(rights);
+    if(exception)
+      std::rethrow_exception(exception);
+  }
+
+  // splitting is the same as in ParallelForRange;
+  // results of right halves are combined with the left one in order of indices
+  template <typename T, typename F, typename Op>
+  Task<T> ParallelReduceRange(size_t begin, size_t end, size_t grain, T const& identity, F& f, Op& op)
+  {
+    std::vector<Task<T>> rights;
+    while(end - begin > grain)
+    {
+      size_t middle = begin + (end - begin) / 2;
+      rights.push_back(ParallelReduceRange(middle, end, grain, identity, f, op));
+      end = middle;
+    }
+
+    T result = identity;
+    std::exception_ptr exception;
+    try
+    {
+      for(size_t i = begin; i < end; ++i)
+        result = op(std::move(result), f(i));
+    }
+    catch(...)
+    {
+      exception = std::current_exception();
+    }
+    // wait for right halves even if left one fails, as they reference the functions
+    std::vector<T> rightResults = co_await WhenAll(rights);
+    if(exception)
+      std::rethrow_exception(exception);
+    // the last right half is the closest to the left one
+    for(size_t i = rightResults.size(); i > 0; --i)
+      result = op(std::move(result), std::move(rightResults[i - 1]));
+    co_return result;
+  }
+
+  template <typename Input, typename Output, typename F>
+  Task<void> ParallelTransformSpans(std::span<Input> input, std::span<Output> output, size_t grain, F f)
+  {
+    if(input.size() != output.size())
+      throw Exception("ParallelTransform input and output sizes mismatch");
+    if(input.empty()) co_return;
+    auto transform = [&](size_t i)
+    {
+      output[i] = f(input[i]);
+    };
+    co_await ParallelForRange(0, input.size(), GetParallelGrain(input.size(), grain), transform);
+  }
+}
+
+export namespace Coil
+{
+  // call f(i) for every i in [begin, end) in parallel
+  // grain is max number of indices processed sequentially, 0 means automatic
+  // f is owned by the task and called as non-const, so mutable lambdas are allowed,
+  // but it is called concurrently from multiple threads
+  template <typename F> requires std::invocable<F&, size_t>
+  Task<void> ParallelFor(size_t begin, size_t end, size_t grain, F f)
+  {
+    if(begin >= end) co_return;
+    co_await ParallelForRange(begin, end, GetParallelGrain(end - begin, grain), f);
+  }
+
+  // reduce values f(i) for every i in [begin, end) with op in parallel
+  // op must be associative; results are combined in order of indices
+  template <typename T, typename F, typename Op> requires std::invocable<F&, size_t> && std::invocable<Op&, T, std::invoke_result_t<F&, size_t>>
+  Task<T> ParallelReduce(size_t begin, size_t end, size_t grain, T identity, F f, Op op)
+  {
+    if(begin >= end) co_return identity;
+    co_return co_await ParallelReduceRange<T>(begin, end, GetParallelGrain(end - begin, grain), identity, f, op);
+  }
+
+  // output[i] = f(input[i]) in parallel
+  // input and output are contiguous ranges (vectors, arrays, spans) of the same size,
+  // and must be kept alive until task finishes
+  template <std::ranges::contiguous_range Input, std::ranges::contiguous_range Output, typename F>
+  Task<void> ParallelTransform(Input&& input, Output&& output, size_t grain, F f)
+  {
+    return ParallelTransformSpans(std::span<std::ranges::range_value_t<Input> const>(input), std::span(output), grain, std::move(f));
+  }
+}
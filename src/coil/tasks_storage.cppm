@@ -3,6 +3,7 @@ module;
 #include <cstddef>
 #include <cstdint>
 #include <coroutine>
+#include <span>
 
 export module coil.core.tasks.storage;
 
@@ -11,10 +12,42 @@ import coil.core.tasks;
 
 export namespace Coil
 {
+  // request for reading range of storage
+  struct AsyncReadRequest
+  {
+    uint64_t offset = 0;
+    Buffer buffer;
+    // set to number of bytes read
+    size_t readSize = 0;
+  };
+
   class AsyncReadableStorage
   {
   public:
     virtual Task<size_t> AsyncRead(uint64_t offset, Buffer const& buffer) const = 0;
+
+    // perform many reads, possibly at once
+    // sets read size for every request
+    virtual Task<void> AsyncReadMany(std::span<AsyncReadRequest> requests) const
+    {
+      for(size_t i = 0; i < requests.size(); ++i)
+        requests[i].readSize = co_await AsyncRead(requests[i].offset, requests[i].buffer);
+    }
+
+    // read consecutive range into multiple buffers
+    // returns total number of bytes read
+    virtual Task<size_t> AsyncReadScatter(uint64_t offset, std::span<Buffer const> buffers) const
+    {
+      size_t totalReadSize = 0;
+      for(size_t i = 0; i < buffers.size(); ++i)
+      {
+        size_t readSize = co_await AsyncRead(offset, buffers[i]);
+        totalReadSize += readSize;
+        offset += readSize;
+        if(readSize < buffers[i].size) break;
+      }
+      co_return totalReadSize;
+    }
   };
 
   class AsyncWritableStorage
@@ -1,5 +1,6 @@
 module;
 
+#include <algorithm>
 #include <coroutine>
 #include <mutex>
 #include <optional>
@@ -25,9 +26,18 @@ export namespace Coil
     // wait until some data appears
     virtual Task<void> WaitForRead() = 0;
 
+    // wait until some data appears, or token is cancelled (throws CancelledException)
+    // default implementation checks token only before and after waiting
+    virtual Task<void> WaitForRead(CancellationToken token)
+    {
+      token.ThrowIfCancelled();
+      co_await WaitForRead();
+      token.ThrowIfCancelled();
+    }
+
     // read some non-zero amount of data, suspend if needed
     // returns zero on stream end
-    Task<size_t> Read(Buffer const& buffer)
+    Task<size_t> Read(Buffer const& buffer, CancellationToken token = {})
     {
       for(;;)
       {
@@ -41,12 +51,12 @@ export namespace Coil
           co_return maybeRead.value();
         }
 
-        co_await WaitForRead();
+        co_await WaitForRead(token);
       }
     }
 
     // read all up to the end
-    Task<std::vector<uint8_t>> ReadAll()
+    Task<std::vector<uint8_t>> ReadAll(CancellationToken token = {})
     {
       std::vector<uint8_t> buffer;
       for(;;)
@@ -73,7 +83,7 @@ export namespace Coil
         else
         {
           buffer.resize(size);
-          co_await WaitForRead();
+          co_await WaitForRead(token);
         }
       }
     }
@@ -136,11 +146,16 @@ export namespace Coil
     }
 
     Task<void> WaitForRead() override
+    {
+      return WaitForRead(CancellationToken{});
+    }
+
+    Task<void> WaitForRead(CancellationToken token) override
     {
       std::unique_lock lock{_mutex};
       while(!_ended && _buffer.GetDataSize() <= 0)
       {
-        co_await _readerVar.Wait(lock);
+        co_await _readerVar.Wait(lock, token);
       }
     }
 
@@ -159,6 +174,10 @@ export namespace Coil
         if(buffer.size <= _bufferSize && _buffer.GetDataSize() + buffer.size > _bufferSize)
           return false;
 
+        // cannot expand buffer while reader works with acquired span
+        if(_readSpanAcquired && _buffer.GetDataSize() + buffer.size > _buffer.GetBufferSize())
+          return false;
+
         // otherwise there's space, write data
         _buffer.Write(buffer);
       }
@@ -179,12 +198,74 @@ export namespace Coil
     Task<void> WaitForWrite(size_t size) override
     {
       std::unique_lock lock{_mutex};
-      while(size <= _bufferSize && _buffer.GetDataSize() + size > _bufferSize)
+      while((size <= _bufferSize && _buffer.GetDataSize() + size > _bufferSize) || (_readSpanAcquired && _buffer.GetDataSize() + size > _buffer.GetBufferSize()))
       {
         co_await _writerVar.Wait(lock);
       }
     }
 
+    // zero-copy reading
+    // get contiguous part of buffered data, to be consumed in place with CommitRead
+    // returns empty optional on stream end, empty buffer if there's no data yet
+    // the span stays valid until CommitRead
+    std::optional<Buffer> AcquireReadSpan()
+    {
+      std::unique_lock lock{_mutex};
+
+      Buffer span = _buffer.GetReadSpan();
+      if(!span.size && _ended) return {};
+      _readSpanAcquired = span.size > 0;
+
+      return span;
+    }
+
+    // consume specified amount of data from acquired span
+    void CommitRead(size_t size)
+    {
+      {
+        std::unique_lock lock{_mutex};
+        if(!_readSpanAcquired && size)
+          throw Exception("commit of suspendable pipe read without acquired span");
+        _buffer.Consume(size);
+        _readSpanAcquired = false;
+      }
+      // notify writer
+      _writerVar.NotifyOne();
+    }
+
+    // zero-copy writing
+    // get contiguous free space of at most specified size, to be filled in place and committed with CommitWrite
+    // returns empty buffer if there's no space yet (use WaitForWrite)
+    // the span may be smaller than requested when free space wraps around
+    Buffer AcquireWriteSpan(size_t size)
+    {
+      std::unique_lock lock{_mutex};
+
+      // allocate buffer lazily
+      if(_buffer.GetBufferSize() < _bufferSize && !_readSpanAcquired)
+        _buffer.Reserve(_bufferSize);
+
+      if(_buffer.GetDataSize() >= _bufferSize) return {};
+      Buffer span = _buffer.GetWriteSpan();
+      span.size = std::min({ span.size, size, _bufferSize - _buffer.GetDataSize() });
+
+      return span;
+    }
+
+    // add specified amount of data written into acquired span
+    void CommitWrite(size_t size)
+    {
+      if(!size) return;
+      {
+        std::unique_lock lock{_mutex};
+        if(_buffer.GetDataSize() + size > _bufferSize)
+          throw Exception("commit of suspendable pipe write is bigger than acquired span");
+        _buffer.Commit(size);
+      }
+      // notify reader
+      _readerVar.NotifyOne();
+    }
+
   private:
     size_t const _bufferSize;
     bool const _allowBufferExpansion;
@@ -193,5 +274,7 @@ export namespace Coil
     ConditionVariable _readerVar;
     ConditionVariable _writerVar;
     bool _ended = false;
+    // reader holds span, so buffer cannot be reallocated
+    bool _readSpanAcquired = false;
   };
 }
@@ -1,9 +1,11 @@
 module;
 
+#include <atomic>
 #include <coroutine>
+#include <cstdint>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <utility>
 
 export module coil.core.tasks.sync;
 
@@ -12,6 +14,7 @@ import coil.core.tasks;
 export namespace Coil
 {
   // condition variable which works with tasks
+  // waiters are stored in awaiters, so waiting does not allocate
   class ConditionVariable
   {
   public:
@@ -20,109 +23,635 @@ export namespace Coil
     class WaitAwaiter
     {
     public:
-      WaitAwaiter(ConditionVariable& cv, std::unique_lock<std::mutex>& userLock)
-      : _cv{cv}, _userLock{userLock} {}
+      WaitAwaiter(ConditionVariable& cv, std::unique_lock<std::mutex>& userLock, CancellationToken const& token)
+      : _cv{cv}, _userLock{userLock}, _token{token}
+      {
+        _waiter.pCv = &cv;
+      }
 
       bool await_ready() const
       {
-        return false;
+        return _token.IsCancelled();
       }
 
-      void await_suspend(std::coroutine_handle<> coroutine)
+      bool await_suspend(std::coroutine_handle<> coroutine)
       {
-        std::unique_lock<std::mutex> lock{_cv._mutex};
+        _waiter.Start(coroutine, _token, &OnCancel);
+
+        {
+          std::unique_lock<std::mutex> lock{_cv._mutex};
 
-        _userLock.unlock();
+          _userLock.unlock();
 
-        _cv._waiters.push(coroutine);
+          _cv.AddWaiter(_waiter);
+        }
+
+        return _waiter.Finish();
       }
 
-      void await_resume() const
+      // throws CancelledException if cancelled
+      void await_resume()
       {
+        // lock is still locked only if cancelled before suspension
+        if(_userLock.owns_lock())
+          throw CancelledException();
         _userLock.lock();
+        _waiter.ThrowIfCancelled();
       }
 
     private:
+      struct Waiter : public CancellableWaiter
+      {
+        ConditionVariable* pCv = nullptr;
+      };
+
+      static void OnCancel(CancellableWaiter& waiter)
+      {
+        Waiter& cvWaiter = static_cast<Waiter&>(waiter);
+        if(cvWaiter.pCv->RemoveWaiter(cvWaiter))
+          cvWaiter.WakeCancelled();
+      }
+
       ConditionVariable& _cv;
       std::unique_lock<std::mutex>& _userLock;
+      CancellationToken const _token;
+      Waiter _waiter;
     };
 
     // unlocks lock, waits until notified, then locks the lock back
     // never suspends while holding a lock because it does not start
     // its own coroutine, but returns simple awaiter
-    WaitAwaiter Wait(std::unique_lock<std::mutex>& userLock)
+    // if token is cancelled, wakes up and throws CancelledException (with the lock locked)
+    WaitAwaiter Wait(std::unique_lock<std::mutex>& userLock, CancellationToken const& token = {})
     {
-      return {*this, userLock};
+      return {*this, userLock, token};
     }
 
     void NotifyOne()
     {
       std::unique_lock<std::mutex> lock{_mutex};
-      if(_waiters.empty()) return;
+      TaskWaiter* waiter = _pWaitersHead;
+      if(!waiter) return;
 
-      std::coroutine_handle<> coroutine = _waiters.front();
-      _waiters.pop();
+      _pWaitersHead = waiter->next;
+      if(!_pWaitersHead) _pWaitersTail = nullptr;
       lock.unlock();
 
-      TaskEngine::GetInstance().Queue(coroutine);
+      Wake(*waiter);
     }
 
     void NotifyAll()
     {
-      std::vector<std::coroutine_handle<>> waiters;
-
       std::unique_lock<std::mutex> lock{_mutex};
-      if(_waiters.empty()) return;
+      TaskWaiter* waiter = std::exchange(_pWaitersHead, nullptr);
+      _pWaitersTail = nullptr;
+      lock.unlock();
 
-      waiters.reserve(_waiters.size());
-      while(!_waiters.empty())
+      while(waiter)
       {
-        waiters.push_back(_waiters.front());
-        _waiters.pop();
+        // read next pointer before resumed coroutine destroys the waiter
+        TaskWaiter* next = waiter->next;
+        Wake(*waiter);
+        waiter = next;
       }
-      lock.unlock();
+    }
 
-      for(size_t i = 0; i < waiters.size(); ++i)
+  private:
+    static void Wake(TaskWaiter& waiter)
+    {
+      if(waiter.callback)
+        waiter.callback(waiter);
+      else
+        waiter.pExecutor->Queue(waiter.coroutine, waiter.priority);
+    }
+
+    // remove waiter from queue, returns false if it's not there
+    bool RemoveWaiter(TaskWaiter& waiter)
+    {
+      std::unique_lock<std::mutex> lock{_mutex};
+      TaskWaiter* pPrev = nullptr;
+      for(TaskWaiter* pWaiter = _pWaitersHead; pWaiter; pPrev = pWaiter, pWaiter = pWaiter->next)
       {
-        TaskEngine::GetInstance().Queue(waiters[i]);
+        if(pWaiter != &waiter) continue;
+        (pPrev ? pPrev->next : _pWaitersHead) = waiter.next;
+        if(_pWaitersTail == &waiter) _pWaitersTail = pPrev;
+        return true;
       }
+      return false;
+    }
+
+    // add waiter to the end of queue, must be called under mutex
+    void AddWaiter(TaskWaiter& waiter)
+    {
+      waiter.next = nullptr;
+      if(_pWaitersTail)
+        _pWaitersTail->next = &waiter;
+      else
+        _pWaitersHead = &waiter;
+      _pWaitersTail = &waiter;
     }
 
-  private:
     std::mutex _mutex;
-    std::queue<std::coroutine_handle<>> _waiters;
+    // queue of waiters, with their executors and priorities
+    TaskWaiter* _pWaitersHead = nullptr;
+    TaskWaiter* _pWaitersTail = nullptr;
   };
 
+  // semaphore which works with tasks
+  // acquiring positive counter is a single atomic operation;
+  // release hands off the counter to waiters directly
   class Semaphore
   {
   public:
     Semaphore(size_t initialCounter = 0)
     : _counter(initialCounter) {}
 
-    Task<void> Acquire()
+    class AcquireAwaiter
     {
-      std::unique_lock lock{_mutex};
-      while(!(_counter > 0))
+    public:
+      AcquireAwaiter(Semaphore& semaphore)
+      : _semaphore{semaphore} {}
+
+      bool await_ready()
+      {
+        return _semaphore.TryAcquire();
+      }
+
+      bool await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        return _semaphore.AddWaiter(_waiter);
+      }
+
+      void await_resume() const
       {
-        co_await _cv.Wait(lock);
       }
-      --_counter;
+
+    private:
+      Semaphore& _semaphore;
+      TaskWaiter _waiter;
+    };
+
+    // decrement counter, waiting until it's positive
+    AcquireAwaiter Acquire()
+    {
+      return *this;
+    }
+
+    // decrement counter if it's positive
+    bool TryAcquire()
+    {
+      size_t counter = _counter.load(std::memory_order_relaxed);
+      do
+      {
+        if(!counter) return false;
+      }
+      while(!_counter.compare_exchange_weak(counter, counter - 1, std::memory_order_acquire, std::memory_order_relaxed));
+      return true;
     }
 
     void Release(size_t increaseCounter = 1)
+    {
+      _counter.fetch_add(increaseCounter, std::memory_order_release);
+
+      // either waiter sees the counter, or we see the waiter
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(_waitersCount.load(std::memory_order_relaxed) == 0) return;
+
+      // acquire counter on behalf of waiters
+      TaskWaiter* waiters = nullptr;
+      TaskWaiter** pWaitersTail = &waiters;
+      {
+        std::unique_lock lock{_mutex};
+        while(_pWaitersHead && TryAcquire())
+        {
+          TaskWaiter* waiter = _pWaitersHead;
+          _pWaitersHead = waiter->next;
+          if(!_pWaitersHead) _pWaitersTail = nullptr;
+          _waitersCount.fetch_sub(1, std::memory_order_relaxed);
+          waiter->next = nullptr;
+          *pWaitersTail = waiter;
+          pWaitersTail = &waiter->next;
+        }
+      }
+
+      while(waiters)
+      {
+        // read next pointer before resumed coroutine destroys the waiter
+        TaskWaiter* next = waiters->next;
+        waiters->pExecutor->Queue(waiters->coroutine, waiters->priority);
+        waiters = next;
+      }
+    }
+
+  private:
+    // acquires counter and returns false if possible, otherwise adds waiter and returns true
+    bool AddWaiter(TaskWaiter& waiter)
     {
       std::unique_lock lock{_mutex};
-      _counter += increaseCounter;
-      lock.unlock();
-      for(size_t i = 0; i < increaseCounter; ++i)
+
+      _waitersCount.fetch_add(1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(TryAcquire())
+      {
+        _waitersCount.fetch_sub(1, std::memory_order_relaxed);
+        return false;
+      }
+
+      waiter.next = nullptr;
+      if(_pWaitersTail)
+        _pWaitersTail->next = &waiter;
+      else
+        _pWaitersHead = &waiter;
+      _pWaitersTail = &waiter;
+      return true;
+    }
+
+    std::atomic<size_t> _counter;
+    std::atomic<size_t> _waitersCount = 0;
+    // protects queue of waiters
+    std::mutex _mutex;
+    TaskWaiter* _pWaitersHead = nullptr;
+    TaskWaiter* _pWaitersTail = nullptr;
+  };
+
+  // mutex which works with tasks
+  // uncontended lock and unlock are single atomic operations; waiters are
+  // stored in awaiters, and unlock hands the lock off to the next waiter
+  class AsyncMutex
+  {
+  public:
+    AsyncMutex() = default;
+    AsyncMutex(AsyncMutex const&) = delete;
+    AsyncMutex& operator=(AsyncMutex const&) = delete;
+
+    class LockAwaiter
+    {
+    public:
+      LockAwaiter(AsyncMutex& mutex)
+      : _mutex{mutex} {}
+
+      bool await_ready()
+      {
+        return _mutex.TryLock();
+      }
+
+      bool await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        return _mutex.AddWaiter(_waiter);
+      }
+
+      void await_resume() const
+      {
+      }
+
+    protected:
+      AsyncMutex& _mutex;
+
+    private:
+      TaskWaiter _waiter;
+    };
+
+    // unlocks mutex on destruction
+    class Guard
+    {
+    public:
+      // adopts already locked mutex
+      Guard(AsyncMutex& mutex)
+      : _pMutex{&mutex} {}
+      Guard(Guard&& other) noexcept
+      : _pMutex{std::exchange(other._pMutex, nullptr)} {}
+      ~Guard()
       {
-        _cv.NotifyOne();
+        if(_pMutex) _pMutex->Unlock();
       }
+
+      Guard(Guard const&) = delete;
+      Guard& operator=(Guard const&) = delete;
+
+    private:
+      AsyncMutex* _pMutex;
+    };
+
+    class ScopedLockAwaiter : public LockAwaiter
+    {
+    public:
+      using LockAwaiter::LockAwaiter;
+
+      Guard await_resume() const
+      {
+        return _mutex;
+      }
+    };
+
+    // lock mutex
+    LockAwaiter Lock()
+    {
+      return *this;
+    }
+
+    // lock mutex, get guard unlocking it
+    ScopedLockAwaiter ScopedLock()
+    {
+      return *this;
+    }
+
+    bool TryLock()
+    {
+      void* state = UnlockedState();
+      return _state.compare_exchange_strong(state, nullptr, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    void Unlock()
+    {
+      TaskWaiter* waiter = _waiters;
+      if(!waiter)
+      {
+        void* state = nullptr;
+        if(_state.compare_exchange_strong(state, UnlockedState(), std::memory_order_release, std::memory_order_relaxed))
+          return;
+
+        // take all new waiters, reversing them into FIFO order
+        TaskWaiter* newWaiter = static_cast<TaskWaiter*>(_state.exchange(nullptr, std::memory_order_acquire));
+        while(newWaiter)
+        {
+          TaskWaiter* next = newWaiter->next;
+          newWaiter->next = waiter;
+          waiter = newWaiter;
+          newWaiter = next;
+        }
+      }
+
+      // hand lock off to the next waiter
+      _waiters = waiter->next;
+      waiter->pExecutor->Queue(waiter->coroutine, waiter->priority);
     }
 
   private:
-    ConditionVariable _cv;
+    // locks mutex and returns false if it's unlocked, otherwise adds waiter and returns true
+    bool AddWaiter(TaskWaiter& waiter)
+    {
+      void* state = _state.load(std::memory_order_relaxed);
+      for(;;)
+      {
+        if(state == UnlockedState())
+        {
+          if(_state.compare_exchange_weak(state, nullptr, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        }
+        else
+        {
+          waiter.next = static_cast<TaskWaiter*>(state);
+          if(_state.compare_exchange_weak(state, &waiter, std::memory_order_release, std::memory_order_relaxed))
+            return true;
+        }
+      }
+    }
+
+    void* UnlockedState()
+    {
+      return this;
+    }
+
+    // own address if unlocked, null if locked without waiters,
+    // otherwise stack of waiters added since last unlock
+    std::atomic<void*> _state = UnlockedState();
+    // waiters in FIFO order, accessed by lock owner only
+    TaskWaiter* _waiters = nullptr;
+  };
+
+  // shared mutex which works with tasks
+  // uncontended lock and unlock are single atomic operations; contended
+  // operations go through internal mutex. Once there are waiters, new lockers
+  // queue after them, and unlock hands the lock off to the next writer,
+  // or to all consecutive readers
+  class AsyncSharedMutex
+  {
+  private:
+    struct Waiter : public TaskWaiter
+    {
+      bool shared = false;
+    };
+
+  public:
+    AsyncSharedMutex() = default;
+    AsyncSharedMutex(AsyncSharedMutex const&) = delete;
+    AsyncSharedMutex& operator=(AsyncSharedMutex const&) = delete;
+
+    class LockAwaiter
+    {
+    public:
+      LockAwaiter(AsyncSharedMutex& mutex, bool shared)
+      : _mutex{mutex}
+      {
+        _waiter.shared = shared;
+      }
+
+      bool await_ready()
+      {
+        return _waiter.shared ? _mutex.TryLockShared() : _mutex.TryLock();
+      }
+
+      bool await_suspend(std::coroutine_handle<> coroutine)
+      {
+        _waiter.coroutine = coroutine;
+        _waiter.pExecutor = &TaskExecutor::GetCurrent();
+        _waiter.priority = TaskEngine::GetCurrentPriority();
+        return _mutex.AddWaiter(_waiter);
+      }
+
+      void await_resume() const
+      {
+      }
+
+    protected:
+      AsyncSharedMutex& _mutex;
+
+    private:
+      Waiter _waiter;
+    };
+
+    // unlocks mutex on destruction
+    class Guard
+    {
+    public:
+      // adopts already locked mutex
+      Guard(AsyncSharedMutex& mutex, bool shared)
+      : _pMutex{&mutex}, _shared{shared} {}
+      Guard(Guard&& other) noexcept
+      : _pMutex{std::exchange(other._pMutex, nullptr)}, _shared{other._shared} {}
+      ~Guard()
+      {
+        if(_pMutex)
+        {
+          if(_shared)
+            _pMutex->UnlockShared();
+          else
+            _pMutex->Unlock();
+        }
+      }
+
+      Guard(Guard const&) = delete;
+      Guard& operator=(Guard const&) = delete;
+
+    private:
+      AsyncSharedMutex* _pMutex;
+      bool _shared;
+    };
+
+    class ScopedLockAwaiter : public LockAwaiter
+    {
+    public:
+      ScopedLockAwaiter(AsyncSharedMutex& mutex, bool shared)
+      : LockAwaiter{mutex, shared}, _shared{shared} {}
+
+      Guard await_resume() const
+      {
+        return { _mutex, _shared };
+      }
+
+    private:
+      bool _shared;
+    };
+
+    // lock exclusively
+    LockAwaiter Lock()
+    {
+      return { *this, false };
+    }
+    // lock shared
+    LockAwaiter LockShared()
+    {
+      return { *this, true };
+    }
+    // lock exclusively, get guard unlocking it
+    ScopedLockAwaiter ScopedLock()
+    {
+      return { *this, false };
+    }
+    // lock shared, get guard unlocking it
+    ScopedLockAwaiter ScopedLockShared()
+    {
+      return { *this, true };
+    }
+
+    bool TryLock()
+    {
+      uint64_t state = 0;
+      return _state.compare_exchange_strong(state, _writerBit, std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    bool TryLockShared()
+    {
+      uint64_t state = _state.load(std::memory_order_relaxed);
+      do
+      {
+        if(state & (_writerBit | _waitersBit)) return false;
+      }
+      while(!_state.compare_exchange_weak(state, state + _readerUnit, std::memory_order_acquire, std::memory_order_relaxed));
+      return true;
+    }
+
+    void Unlock()
+    {
+      uint64_t state = _writerBit;
+      if(_state.compare_exchange_strong(state, 0, std::memory_order_release, std::memory_order_relaxed))
+        return;
+      HandOff();
+    }
+
+    void UnlockShared()
+    {
+      // the last reader hands off the lock if there are waiters
+      if(_state.fetch_sub(_readerUnit, std::memory_order_release) - _readerUnit == _waitersBit)
+        HandOff();
+    }
+
+  private:
+    // locks mutex and returns false if possible, otherwise adds waiter and returns true
+    bool AddWaiter(Waiter& waiter)
+    {
+      std::unique_lock lock{_mutex};
+      uint64_t state = _state.load(std::memory_order_relaxed);
+      for(;;)
+      {
+        // lock is never free while there are waiters
+        if(!(state & _waitersBit) && (waiter.shared ? !(state & _writerBit) : state == 0))
+        {
+          if(_state.compare_exchange_weak(state, waiter.shared ? state + _readerUnit : _writerBit, std::memory_order_acquire, std::memory_order_relaxed))
+            return false;
+        }
+        else
+        {
+          if(_state.compare_exchange_weak(state, state | _waitersBit, std::memory_order_relaxed, std::memory_order_relaxed))
+            break;
+        }
+      }
+
+      waiter.next = nullptr;
+      if(_pWaitersTail)
+        _pWaitersTail->next = &waiter;
+      else
+        _pWaitersHead = &waiter;
+      _pWaitersTail = &waiter;
+      return true;
+    }
+
+    // pass lock to waiters, called when lock is released with waiters bit set
+    void HandOff()
+    {
+      std::unique_lock lock{_mutex};
+
+      // take the next writer, or all consecutive readers
+      Waiter* pFirst = _pWaitersHead;
+      Waiter* pLast = pFirst;
+      uint64_t state;
+      if(pFirst->shared)
+      {
+        state = _readerUnit;
+        while(pLast->next && static_cast<Waiter*>(pLast->next)->shared)
+        {
+          pLast = static_cast<Waiter*>(pLast->next);
+          state += _readerUnit;
+        }
+      }
+      else
+      {
+        state = _writerBit;
+      }
+
+      _pWaitersHead = static_cast<Waiter*>(pLast->next);
+      if(_pWaitersHead)
+        state |= _waitersBit;
+      else
+        _pWaitersTail = nullptr;
+      pLast->next = nullptr;
+      _state.store(state, std::memory_order_release);
+      lock.unlock();
+
+      for(TaskWaiter* waiter = pFirst; waiter; )
+      {
+        // read next pointer before resumed coroutine destroys the waiter
+        TaskWaiter* next = waiter->next;
+        waiter->pExecutor->Queue(waiter->coroutine, waiter->priority);
+        waiter = next;
+      }
+    }
+
+    static constexpr uint64_t _writerBit = 1;
+    static constexpr uint64_t _waitersBit = 2;
+    static constexpr uint64_t _readerUnit = 4;
+
+    // writer bit, waiters bit, and number of readers
+    std::atomic<uint64_t> _state = 0;
+    // protects waiters queue
     std::mutex _mutex;
-    size_t _counter;
+    Waiter* _pWaitersHead = nullptr;
+    Waiter* _pWaitersTail = nullptr;
   };
 }
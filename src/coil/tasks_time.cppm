@@ -0,0 +1,478 @@
+module;
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <stop_token>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+export module coil.core.tasks.time;
+
+import coil.core.tasks;
+import coil.core.time;
+
+export namespace Coil
+{
+  // node of timer wheel
+  // stored by the waiting side (usually in awaiter), so timers do not allocate
+  struct TaskTimer
+  {
+    // expiration time
+    Time::Tick deadline = 0;
+    // called when timer expires
+    void (*callback)(TaskTimer& timer) = nullptr;
+
+    // wheel bookkeeping
+    TaskTimer* next = nullptr;
+    TaskTimer** pPrev = nullptr;
+    uint64_t expires = 0;
+  };
+
+  // hierarchical timer wheel
+  // time is counted in slots of fixed resolution; every level
+  // has 64 slots, and every slot of upper level spans whole lower level;
+  // adding and removing timers is O(1), timers are moved to lower levels
+  // when their upper level slot comes
+  // not thread-safe
+  class TimerWheel
+  {
+  public:
+    TimerWheel(Time::Tick resolution, Time::Tick currentTick)
+    : _resolution(resolution), _current(currentTick / resolution) {}
+
+    TimerWheel(TimerWheel const&) = delete;
+    TimerWheel& operator=(TimerWheel const&) = delete;
+
+    void Add(TaskTimer& timer)
+    {
+      uint64_t expires = (timer.deadline + _resolution - 1) / _resolution;
+      // expired timers fire on next advance
+      timer.expires = std::max(expires, _current + 1);
+      Link(timer);
+      ++_timersCount;
+    }
+
+    // returns false if timer is not in the wheel
+    bool Remove(TaskTimer& timer)
+    {
+      if(!timer.pPrev) return false;
+      Unlink(timer);
+      --_timersCount;
+      return true;
+    }
+
+    bool IsEmpty() const
+    {
+      return !_timersCount;
+    }
+
+    // advance time, calling function for every expired timer
+    // timers are removed from the wheel before the call
+    template <typename F>
+    void Advance(Time::Tick tick, F const& onExpired)
+    {
+      uint64_t target = tick / _resolution;
+      while(_current < target)
+      {
+        // nothing to do, just jump
+        if(!_timersCount)
+        {
+          _current = target;
+          break;
+        }
+
+        ++_current;
+
+        // move timers from upper levels down
+        for(size_t level = 1; level < _levelsCount && !(_current & ((uint64_t(1) << (_slotBits * level)) - 1)); ++level)
+        {
+          TaskTimer* timer = DetachSlot(level, (_current >> (_slotBits * level)) & _slotMask);
+          while(timer)
+          {
+            TaskTimer* next = timer->next;
+            Link(*timer);
+            timer = next;
+          }
+        }
+
+        // expire timers in current slot
+        TaskTimer* timer = DetachSlot(0, _current & _slotMask);
+        while(timer)
+        {
+          TaskTimer* next = timer->next;
+          --_timersCount;
+          onExpired(*timer);
+          timer = next;
+        }
+      }
+    }
+
+    // tick when wheel needs to be advanced next time, if there're any timers
+    std::optional<Time::Tick> GetNextTick() const
+    {
+      if(!_timersCount) return {};
+      // next non-empty slot on lowest level, or next moving of timers from upper levels
+      uint64_t i = _current + 1;
+      while((i & _slotMask) && !_slots[0][i & _slotMask])
+        ++i;
+      return i * _resolution;
+    }
+
+  private:
+    void Link(TaskTimer& timer)
+    {
+      uint64_t delta = timer.expires > _current ? timer.expires - _current : 0;
+      size_t level = 0;
+      while(level + 1 < _levelsCount && delta >= (uint64_t(1) << (_slotBits * (level + 1))))
+        ++level;
+      // timers too far away are put into last slot, to be moved later
+      uint64_t expires = std::min(timer.expires, _current + (uint64_t(1) << (_slotBits * _levelsCount)) - 1);
+
+      TaskTimer*& slot = _slots[level][(expires >> (_slotBits * level)) & _slotMask];
+      timer.next = slot;
+      if(slot) slot->pPrev = &timer.next;
+      timer.pPrev = &slot;
+      slot = &timer;
+    }
+
+    void Unlink(TaskTimer& timer)
+    {
+      *timer.pPrev = timer.next;
+      if(timer.next) timer.next->pPrev = timer.pPrev;
+      timer.next = nullptr;
+      timer.pPrev = nullptr;
+    }
+
+    TaskTimer* DetachSlot(size_t level, size_t index)
+    {
+      TaskTimer* first = _slots[level][index];
+      _slots[level][index] = nullptr;
+      for(TaskTimer* timer = first; timer; timer = timer->next)
+        timer->pPrev = nullptr;
+      return first;
+    }
+
+    static constexpr size_t _slotBits = 6;
+    static constexpr uint64_t _slotMask = (uint64_t(1) << _slotBits) - 1;
+    static constexpr size_t _levelsCount = 5;
+
+    Time::Tick const _resolution;
+    uint64_t _current;
+    size_t _timersCount = 0;
+    TaskTimer* _slots[_levelsCount][_slotMask + 1] = {};
+  };
+
+  // singleton class servicing timers for tasks
+  // single thread advances the wheel, sleeping until next expiration
+  class TaskTimers
+  {
+  private:
+    TaskTimers()
+    : _wheel(std::max<Time::Tick>(Time::ticksPerSecond / 1000, 1), Time::GetTick())
+    {
+      _thread = std::jthread([this](std::stop_token stopToken)
+      {
+        ThreadHandler(stopToken);
+      });
+    }
+
+  public:
+    void Add(TaskTimer& timer)
+    {
+      std::unique_lock lock(_mutex);
+      // synchronize empty wheel with current time, so it doesn't need to catch up later
+      if(_wheel.IsEmpty())
+        _wheel.Advance(Time::GetTick(), [](TaskTimer&) {});
+      _wheel.Add(timer);
+      // wake up thread if timer is earlier than planned wakeup
+      if(timer.deadline < _nextWakeTick)
+      {
+        _nextWakeTick = timer.deadline;
+        _wakeRequested = true;
+        _cv.notify_one();
+      }
+    }
+
+    // returns false if timer has already expired, and its callback
+    // may still be running or about to run; otherwise callback will not run
+    bool Remove(TaskTimer& timer)
+    {
+      std::unique_lock lock(_mutex);
+      return _wheel.Remove(timer);
+    }
+
+    static TaskTimers& GetInstance()
+    {
+      static TaskTimers instance;
+      return instance;
+    }
+
+    template <typename Rep, typename Period>
+    static Time::Tick DurationToTicks(std::chrono::duration<Rep, Period> duration)
+    {
+      uint64_t nanoseconds = std::max<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), 0);
+      return nanoseconds / 1000000000ULL * Time::ticksPerSecond + nanoseconds % 1000000000ULL * Time::ticksPerSecond / 1000000000ULL;
+    }
+
+  private:
+    void ThreadHandler(std::stop_token const& stopToken)
+    {
+      std::unique_lock lock(_mutex);
+      while(!stopToken.stop_requested())
+      {
+        // collect expired timers under lock, and call them without it,
+        // so callbacks can add timers; expired timers are already
+        // out of the wheel, so nobody else touches them
+        TaskTimer* pExpired = nullptr;
+        TaskTimer** ppExpiredTail = &pExpired;
+        _wheel.Advance(Time::GetTick(), [&](TaskTimer& timer)
+        {
+          timer.next = nullptr;
+          *ppExpiredTail = &timer;
+          ppExpiredTail = &timer.next;
+        });
+        if(pExpired)
+        {
+          lock.unlock();
+          while(pExpired)
+          {
+            // read next pointer before callback lets owner reuse the timer
+            TaskTimer* pNext = pExpired->next;
+            pExpired->callback(*pExpired);
+            pExpired = pNext;
+          }
+          lock.lock();
+          continue;
+        }
+
+        std::optional<Time::Tick> nextTick = _wheel.GetNextTick();
+        _nextWakeTick = nextTick.value_or(std::numeric_limits<Time::Tick>::max());
+        _wakeRequested = false;
+        auto predicate = [&]()
+        {
+          return _wakeRequested;
+        };
+        if(nextTick.has_value())
+        {
+          Time::Tick tick = Time::GetTick();
+          if(nextTick.value() > tick)
+          {
+            Time::Tick ticks = nextTick.value() - tick;
+            _cv.wait_for(lock, stopToken, std::chrono::nanoseconds(ticks / Time::ticksPerSecond * 1000000000ULL + ticks % Time::ticksPerSecond * 1000000000ULL / Time::ticksPerSecond), predicate);
+          }
+        }
+        else
+        {
+          _cv.wait(lock, stopToken, predicate);
+        }
+      }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable_any _cv;
+    TimerWheel _wheel;
+    Time::Tick _nextWakeTick = std::numeric_limits<Time::Tick>::max();
+    bool _wakeRequested = false;
+    std::jthread _thread;
+  };
+
+  // awaiter suspending coroutine until specified time
+  // cancelled sleep wakes up right away with CancelledException
+  class SleepAwaiter
+  {
+  public:
+    SleepAwaiter(Time::Tick deadline, CancellationToken token = {})
+    : _token(std::move(token))
+    {
+      _timer.deadline = deadline;
+      _timer.TaskTimer::callback = &OnTimer;
+    }
+
+    bool await_ready() const
+    {
+      return _timer.deadline <= Time::GetTick() || _token.IsCancelled();
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      _suspended = true;
+      _timer.Start(coroutine, _token, &OnCancel);
+      TaskTimers::GetInstance().Add(_timer);
+      return _timer.Finish();
+    }
+
+    void await_resume()
+    {
+      if(_suspended)
+        _timer.ThrowIfCancelled();
+      else
+        _token.ThrowIfCancelled();
+    }
+
+  private:
+    struct Timer : public TaskTimer, public CancellableWaiter
+    {
+    };
+
+    static void OnTimer(TaskTimer& timer)
+    {
+      static_cast<Timer&>(timer).Wake();
+    }
+
+    static void OnCancel(CancellableWaiter& waiter)
+    {
+      Timer& timer = static_cast<Timer&>(waiter);
+      if(TaskTimers::GetInstance().Remove(timer))
+        timer.WakeCancelled();
+    }
+
+    CancellationToken const _token;
+    Timer _timer;
+    bool _suspended = false;
+  };
+
+  // suspend current coroutine until specified tick
+  SleepAwaiter SleepUntil(Time::Tick tick, CancellationToken token = {})
+  {
+    return { tick, std::move(token) };
+  }
+
+  // suspend current coroutine for specified duration
+  template <typename Rep, typename Period>
+  SleepAwaiter SleepFor(std::chrono::duration<Rep, Period> duration, CancellationToken token = {})
+  {
+    return { Time::GetTick() + TaskTimers::DurationToTicks(duration), std::move(token) };
+  }
+
+  // awaiter waiting for task with deadline
+  // returns true if task completed, false on timeout
+  // on timeout, small waiter state stays registered in the task, and is freed
+  // only when the task completes (never, if it never completes), because
+  // waiter cannot be safely removed from task's lock-free waiter list
+  template <typename R>
+  class TimeoutAwaiter
+  {
+  public:
+    TimeoutAwaiter(Task<R> const& task, Time::Tick deadline)
+    : _task(task), _deadline(deadline) {}
+
+    bool await_ready()
+    {
+      _completed = _task.IsReady();
+      // no need to wait if deadline has already passed
+      return _completed || _deadline <= Time::GetTick();
+    }
+
+    bool await_suspend(std::coroutine_handle<> coroutine)
+    {
+      // state outlives the awaiter, as task cannot forget waiter
+      State* pState = new State();
+      pState->TaskWaiter::callback = &OnTaskCompleted;
+      pState->TaskTimer::callback = &OnTimer;
+      pState->deadline = _deadline;
+      pState->pAwaiter = this;
+      pState->awaitingCoroutine = coroutine;
+      pState->pAwaitingExecutor = &TaskExecutor::GetCurrent();
+      pState->awaitingPriority = TaskEngine::GetCurrentPriority();
+
+      // register in task first, as task completion may resume the coroutine
+      // and destroy the awaiter; nothing is published before that
+      if(!_task.AddWaiter(*pState))
+      {
+        delete pState;
+        _completed = true;
+        return false;
+      }
+      // awaiter must not be touched after this point; timer's reference
+      // keeps the state alive until the timer is added
+      TaskTimers::GetInstance().Add(*pState);
+      return true;
+    }
+
+    bool await_resume() const
+    {
+      return _completed;
+    }
+
+  private:
+    struct State : public TaskWaiter, public TaskTimer
+    {
+      // first one resumes the coroutine
+      void Finish(bool completed)
+      {
+        if(!finished.exchange(true, std::memory_order_acq_rel))
+        {
+          pAwaiter->_completed = completed;
+          pAwaitingExecutor->Queue(awaitingCoroutine, awaitingPriority);
+        }
+      }
+
+      void Release(uint32_t count)
+      {
+        if(refCount.fetch_sub(count, std::memory_order_acq_rel) == count)
+          delete this;
+      }
+
+      TimeoutAwaiter* pAwaiter = nullptr;
+      std::coroutine_handle<> awaitingCoroutine;
+      TaskExecutor* pAwaitingExecutor = nullptr;
+      TaskPriority awaitingPriority = TaskPriority::Normal;
+      std::atomic<bool> finished = false;
+      // one reference for the task waiter, one for the timer
+      std::atomic<uint32_t> refCount = 2;
+    };
+
+    static void OnTaskCompleted(TaskWaiter& waiter)
+    {
+      State& state = static_cast<State&>(waiter);
+      // if timer is removed, its reference is released here too;
+      // if it's not added yet, it will fire later and release its own reference
+      bool timerRemoved = TaskTimers::GetInstance().Remove(state);
+      state.Finish(true);
+      state.Release(timerRemoved ? 2 : 1);
+    }
+
+    static void OnTimer(TaskTimer& timer)
+    {
+      State& state = static_cast<State&>(timer);
+      state.Finish(false);
+      state.Release(1);
+    }
+
+    Task<R> const& _task;
+    Time::Tick const _deadline;
+    bool _completed = false;
+  };
+
+  // wait for task with timeout
+  // returns empty optional (or false for void tasks) on timeout
+  // task is not stopped on timeout, and keeps small waiter state allocated
+  // until it completes; tasks which may never complete should be cancelled
+  // with CancellationToken instead
+  template <typename R, typename Rep, typename Period>
+  Task<std::conditional_t<std::same_as<R, void>, bool, std::optional<R>>> WithTimeout(Task<R> task, std::chrono::duration<Rep, Period> duration)
+  {
+    bool completed = co_await TimeoutAwaiter<R>(task, Time::GetTick() + TaskTimers::DurationToTicks(duration));
+    if(!completed)
+      co_return {};
+
+    if constexpr(std::same_as<R, void>)
+    {
+      co_await task;
+      co_return true;
+    }
+    else
+    {
+      co_return co_await task;
+    }
+  }
+}
@@ -0,0 +1,176 @@
+#include "entrypoint.hpp"
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+import coil.core.base;
+
+using namespace Coil;
+
+// object recording its destruction
+struct Tracked
+{
+  Tracked(std::vector<uint32_t>& destroyed, uint32_t index)
+  : destroyed(destroyed), index(index) {}
+  ~Tracked()
+  {
+    destroyed.push_back(index);
+  }
+
+  std::vector<uint32_t>& destroyed;
+  uint32_t index;
+  // not trivially destructible member, to check it's destroyed too
+  std::string name = "tracked";
+};
+
+template <size_t size>
+struct TrackedLarge : public Tracked
+{
+  using Tracked::Tracked;
+  std::array<uint8_t, size> data;
+};
+
+struct alignas(16) AlignedPod
+{
+  uint8_t data[3];
+};
+
+bool TestLargeObjects()
+{
+  std::vector<uint32_t> destroyed;
+  {
+    Book book;
+    book.Allocate<Tracked>(destroyed, 0);
+    // larger than any chunk
+    auto& large = book.Allocate<TrackedLarge<0x200000>>(destroyed, 1);
+    large.data.fill(1);
+    auto& largePod = book.Allocate<std::array<uint8_t, 0x200000>>();
+    largePod.fill(2);
+    book.Allocate<Tracked>(destroyed, 2);
+    if(large.data[0x1fffff] != 1 || largePod[0x1fffff] != 2)
+    {
+      std::cerr << "large object data corrupted\n";
+      return false;
+    }
+  }
+  if(destroyed != std::vector<uint32_t>{ 2, 1, 0 })
+  {
+    std::cerr << "large object is not destroyed\n";
+    return false;
+  }
+  return true;
+}
+
+bool TestDestructionOrder()
+{
+  std::vector<uint32_t> destroyed;
+  Book book(0x100);
+  uint32_t const count = 1000;
+  uint32_t sum = 0;
+  std::vector<uint32_t*> pods;
+  for(uint32_t i = 0; i < count; ++i)
+  {
+    book.Allocate<Tracked>(destroyed, i);
+    uint32_t& pod = book.Allocate<uint32_t>(i);
+    pods.push_back(&pod);
+    book.Allocate<std::array<uint8_t, 100>>();
+  }
+  // headerless objects are not overwritten by others
+  for(uint32_t i = 0; i < count; ++i)
+    sum += *pods[i];
+  if(sum != count * (count - 1) / 2)
+  {
+    std::cerr << "trivially destructible objects corrupted\n";
+    return false;
+  }
+  if(!destroyed.empty())
+  {
+    std::cerr << "objects destroyed too early\n";
+    return false;
+  }
+  book.Free();
+  if(destroyed.size() != count)
+  {
+    std::cerr << "wrong number of destroyed objects " << destroyed.size() << "\n";
+    return false;
+  }
+  for(uint32_t i = 0; i < count; ++i)
+    if(destroyed[i] != count - 1 - i)
+    {
+      std::cerr << "wrong order of destruction\n";
+      return false;
+    }
+  return true;
+}
+
+bool TestReuse()
+{
+  std::vector<uint32_t> destroyed;
+  Book book(0x100);
+  for(uint32_t round = 0; round < 3; ++round)
+  {
+    destroyed.clear();
+    for(uint32_t i = 0; i < 100; ++i)
+    {
+      book.Allocate<Tracked>(destroyed, i);
+      book.Allocate<uint64_t>(i);
+    }
+    book.Allocate<TrackedLarge<0x1000>>(destroyed, 100);
+    book.Free();
+    if(destroyed.size() != 101)
+    {
+      std::cerr << "wrong number of destroyed objects after reuse\n";
+      return false;
+    }
+  }
+
+  // objects are moved with the book
+  destroyed.clear();
+  Book other;
+  other.Allocate<Tracked>(destroyed, 0);
+  book = std::move(other);
+  other.Free();
+  if(!destroyed.empty())
+  {
+    std::cerr << "objects destroyed by moved-from book\n";
+    return false;
+  }
+  book.Free();
+  if(destroyed.size() != 1)
+  {
+    std::cerr << "moved objects are not destroyed\n";
+    return false;
+  }
+  return true;
+}
+
+bool TestAlignment()
+{
+  Book book(0x100);
+  for(uint32_t i = 0; i < 1000; ++i)
+  {
+    // odd sizes in between
+    book.Allocate<uint8_t>();
+    book.Allocate<std::array<uint8_t, 7>>();
+    AlignedPod& pod = book.Allocate<AlignedPod>();
+    uint64_t& value = book.Allocate<uint64_t>();
+    if((uintptr_t)&pod % alignof(AlignedPod) || (uintptr_t)&value % alignof(uint64_t))
+    {
+      std::cerr << "misaligned object\n";
+      return false;
+    }
+  }
+  return true;
+}
+
+int COIL_ENTRY_POINT(std::vector<std::string> args)
+{
+  if(!TestLargeObjects()) return 1;
+  if(!TestDestructionOrder()) return 1;
+  if(!TestReuse()) return 1;
+  if(!TestAlignment()) return 1;
+
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "base.hpp"
+#include "entrypoint.hpp"
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+
+#if defined(COIL_PLATFORM_POSIX)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+import coil.core.base;
+import coil.core.curl;
+import coil.core.tasks.sync;
+import coil.core.tasks;
+
+using namespace Coil;
+
+// reading response of cancelled request through zero-copy API
+// must end with CancelledException, same as TryRead
+Task<bool> TestCancelledSpanRead(std::shared_ptr<CurlManager> pManager, std::string url)
+{
+  CancellationSource source;
+  CurlManager::RequestInfo info;
+  info.url = std::move(url);
+  info.cancellationToken = source.GetToken();
+  auto pRequest = pManager->CreateRequest(info);
+  source.Cancel();
+
+  bool cancelled = false;
+  try
+  {
+    for(;;)
+    {
+      std::optional<Buffer> span = pRequest->AcquireReadSpan();
+      if(!span.has_value()) break;
+      if(span->size)
+        pRequest->CommitRead(span->size);
+      else
+        co_await pRequest->WaitForRead();
+    }
+  }
+  catch(CancelledException const&)
+  {
+    cancelled = true;
+  }
+  if(!cancelled)
+  {
+    std::cerr << "span reading of cancelled request ended without exception\n";
+    co_return false;
+  }
+  co_return true;
+}
+
+int COIL_ENTRY_POINT(std::vector<std::string> args)
+{
+#if defined(COIL_PLATFORM_POSIX)
+  TaskEngine::GetInstance().AddThread();
+
+  // local server which accepts connections (via backlog) but never responds,
+  // so the request can only end by cancellation
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addressSize = sizeof(address);
+  if(server < 0
+    || bind(server, (sockaddr*)&address, sizeof(address))
+    || listen(server, 16)
+    || getsockname(server, (sockaddr*)&address, &addressSize))
+  {
+    std::cerr << "failed to start local server\n";
+    return 1;
+  }
+  std::string url = "http://127.0.0.1:" + std::to_string(ntohs(address.sin_port)) + "/";
+
+  bool ok = TestCancelledSpanRead(CurlManager::Create(), url).Get();
+  close(server);
+  if(!ok) return 1;
+#endif
+
+  return 0;
+}
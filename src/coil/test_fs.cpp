@@ -0,0 +1,153 @@
+#include "entrypoint.hpp"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+import coil.core.base;
+import coil.core.fs;
+import coil.core.tasks.storage;
+import coil.core.tasks;
+
+using namespace Coil;
+
+// forwards only AsyncRead, so default implementations of other reads are used
+class ForwardingStorage final : public AsyncReadableStorage
+{
+public:
+  ForwardingStorage(AsyncReadableStorage const& storage)
+  : _storage(storage) {}
+
+  Task<size_t> AsyncRead(uint64_t offset, Buffer const& buffer) const override
+  {
+    return _storage.AsyncRead(offset, buffer);
+  }
+
+private:
+  AsyncReadableStorage const& _storage;
+};
+
+bool CheckData(std::vector<uint8_t> const& data, uint64_t offset, uint8_t const* read, size_t size)
+{
+  for(size_t i = 0; i < size; ++i)
+    if(read[i] != data[offset + i])
+      return false;
+  return true;
+}
+
+Task<bool> TestReadMany(AsyncReadableStorage const& storage, std::vector<uint8_t> const& data)
+{
+  size_t const size = data.size();
+  // offsets and sizes: from the beginning, in the middle, crossing end of file, after end of file
+  std::pair<uint64_t, size_t> const ranges[] =
+  {
+    { 0, 1000 },
+    { 12345, 5000 },
+    { size - 100, 1000 },
+    { size + 10, 10 },
+  };
+  size_t const expectedSizes[] = { 1000, 5000, 100, 0 };
+  size_t const count = sizeof(ranges) / sizeof(ranges[0]);
+
+  std::vector<std::vector<uint8_t>> buffers(count);
+  std::vector<AsyncReadRequest> requests(count);
+  for(size_t i = 0; i < count; ++i)
+  {
+    buffers[i].resize(ranges[i].second);
+    requests[i].offset = ranges[i].first;
+    requests[i].buffer = Buffer(buffers[i]);
+  }
+  co_await storage.AsyncReadMany(requests);
+
+  for(size_t i = 0; i < count; ++i)
+  {
+    if(requests[i].readSize != expectedSizes[i])
+    {
+      std::cerr << "batched read " << i << ": wrong read size " << requests[i].readSize << "\n";
+      co_return false;
+    }
+    if(!CheckData(data, requests[i].offset, buffers[i].data(), requests[i].readSize))
+    {
+      std::cerr << "batched read " << i << ": wrong data\n";
+      co_return false;
+    }
+  }
+  co_return true;
+}
+
+Task<bool> TestReadScatter(AsyncReadableStorage const& storage, std::vector<uint8_t> const& data)
+{
+  // more buffers than fit into single vectored read (IOV_MAX is usually 1024),
+  // with total size crossing end of file
+  uint64_t const offset = 7;
+  size_t const buffersCount = 3000;
+  std::vector<std::vector<uint8_t>> buffers(buffersCount);
+  std::vector<Buffer> spans(buffersCount);
+  size_t totalSize = 0;
+  for(size_t i = 0; i < buffersCount; ++i)
+  {
+    buffers[i].resize(1 + i % 50);
+    spans[i] = Buffer(buffers[i]);
+    totalSize += buffers[i].size();
+  }
+  if(offset + totalSize <= data.size())
+  {
+    std::cerr << "scattered read doesn't cross end of file\n";
+    co_return false;
+  }
+
+  size_t readSize = co_await storage.AsyncReadScatter(offset, spans);
+  if(readSize != data.size() - offset)
+  {
+    std::cerr << "scattered read: wrong read size " << readSize << "\n";
+    co_return false;
+  }
+  uint64_t bufferOffset = offset;
+  for(size_t i = 0; i < buffersCount && bufferOffset < data.size(); ++i)
+  {
+    size_t bufferReadSize = std::min<size_t>(buffers[i].size(), data.size() - bufferOffset);
+    if(!CheckData(data, bufferOffset, buffers[i].data(), bufferReadSize))
+    {
+      std::cerr << "scattered read: wrong data in buffer " << i << "\n";
+      co_return false;
+    }
+    bufferOffset += bufferReadSize;
+  }
+  co_return true;
+}
+
+int COIL_ENTRY_POINT(std::vector<std::string> args)
+{
+  TaskEngine::GetInstance().AddThread();
+
+  std::string const path = (std::filesystem::temp_directory_path() / "coil_test_fs.bin").string();
+  std::vector<uint8_t> data(60000);
+  for(size_t i = 0; i < data.size(); ++i)
+    data[i] = (uint8_t)(i % 251);
+
+  bool ok = true;
+  {
+    Book book;
+    File::OpenWrite(book, path).Write(0, Buffer(data));
+
+    // file's own batched and vectored reads, and default ones on top of plain reads
+    File& file = File::OpenRead(book, path);
+    ForwardingStorage forwarding(file);
+    ok = [&]() -> Task<bool>
+    {
+      bool ok = true;
+      ok = co_await TestReadMany(file, data) && ok;
+      ok = co_await TestReadScatter(file, data) && ok;
+      ok = co_await TestReadMany(forwarding, data) && ok;
+      ok = co_await TestReadScatter(forwarding, data) && ok;
+      co_return ok;
+    }().Get();
+  }
+  std::filesystem::remove(path);
+
+  if(!ok) return 1;
+
+  return 0;
+}
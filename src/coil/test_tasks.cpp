@@ -1,15 +1,33 @@
 #include "base.hpp"
 #include "entrypoint.hpp"
+#include <algorithm>
+#include <chrono>
 #include <coroutine>
+#include <cstdio>
 #include <iostream>
 #include <memory>
 #include <random>
+#include <string>
+#include <thread>
+#include <utility>
+
+#if defined(COIL_PLATFORM_POSIX)
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
 
 import coil.core.base;
 import coil.core.math;
+import coil.core.tasks.blocking;
+import coil.core.tasks.channel;
+import coil.core.tasks.generator;
+import coil.core.tasks.io;
+import coil.core.tasks.parallel;
 import coil.core.tasks.streams;
 import coil.core.tasks.sync;
+import coil.core.tasks.time;
 import coil.core.tasks;
+import coil.core.time;
 
 using namespace Coil;
 
@@ -148,6 +166,587 @@ public:
     }
 #endif
 
+    // priorities
+    {
+      AddTest([]() -> Task<bool>
+      {
+        co_await SwitchPriority(TaskPriority::Background);
+        bool ok = TaskEngine::GetCurrentPriority() == TaskPriority::Background;
+        // child tasks inherit priority
+        bool childOk = co_await []() -> Task<bool>
+        {
+          co_return TaskEngine::GetCurrentPriority() == TaskPriority::Background;
+        }();
+        co_await SwitchPriority(TaskPriority::Realtime);
+        co_return ok && childOk && TaskEngine::GetCurrentPriority() == TaskPriority::Realtime;
+      }());
+    }
+
+    // timers
+    {
+      AddTest([]() -> Task<bool>
+      {
+        Time::Tick startTick = Time::GetTick();
+        co_await SleepFor(std::chrono::milliseconds(10));
+        co_return Time::GetTick() - startTick >= TaskTimers::DurationToTicks(std::chrono::milliseconds(10));
+      }());
+
+      AddTest([]() -> Task<bool>
+      {
+        auto slowTask = []() -> Task<uint32_t>
+        {
+          co_await SleepFor(std::chrono::milliseconds(100));
+          co_return 1;
+        }();
+        auto fastTask = []() -> Task<uint32_t>
+        {
+          co_return 2;
+        }();
+        auto slowResult = co_await WithTimeout(slowTask, std::chrono::milliseconds(10));
+        auto fastResult = co_await WithTimeout(fastTask, std::chrono::seconds(10));
+        co_return !slowResult.has_value() && fastResult == 2;
+      }());
+
+      // deadlines racing with task completion
+      AddTest([]() -> Task<bool>
+      {
+        bool ok = true;
+        for(uint32_t i = 0; i < 1000; ++i)
+        {
+          auto task = [](uint32_t i) -> Task<uint32_t>
+          {
+            co_return i;
+          }(i);
+          auto result = co_await WithTimeout(task, std::chrono::microseconds(i % 3));
+          ok = ok && (!result.has_value() || result.value() == i);
+          co_await task;
+        }
+        // already passed deadline does not wait
+        auto slowTask = []() -> Task<uint32_t>
+        {
+          co_await SleepFor(std::chrono::milliseconds(10));
+          co_return 0;
+        }();
+        ok = ok && !(co_await WithTimeout(slowTask, std::chrono::milliseconds(0))).has_value();
+        co_await slowTask;
+        co_return ok;
+      }());
+
+      // timer callback can re-arm timer
+      AddTest([]() -> Task<bool>
+      {
+        struct RearmingTimer : public TaskTimer
+        {
+          std::coroutine_handle<> coroutine;
+          uint32_t firesCount = 0;
+        };
+        struct Awaiter
+        {
+          bool await_ready() const
+          {
+            return false;
+          }
+          void await_suspend(std::coroutine_handle<> coroutine)
+          {
+            timer.coroutine = coroutine;
+            timer.deadline = Time::GetTick();
+            timer.callback = [](TaskTimer& taskTimer)
+            {
+              RearmingTimer& timer = static_cast<RearmingTimer&>(taskTimer);
+              if(++timer.firesCount < 3)
+              {
+                timer.deadline = Time::GetTick() + TaskTimers::DurationToTicks(std::chrono::milliseconds(1));
+                TaskTimers::GetInstance().Add(timer);
+              }
+              else
+                TaskEngine::GetInstance().Queue(timer.coroutine, TaskPriority::Normal);
+            };
+            TaskTimers::GetInstance().Add(timer);
+          }
+          uint32_t await_resume() const
+          {
+            return timer.firesCount;
+          }
+          RearmingTimer timer;
+        };
+        co_return co_await Awaiter{} == 3;
+      }());
+    }
+
+    // frame allocator
+    {
+      AddTest([]() -> Task<bool>
+      {
+        auto statsBefore = TaskFrameAllocator::GetStats();
+        for(size_t i = 0; i < 100; ++i)
+          co_await []() -> Task<void>
+          {
+            co_return;
+          }();
+        auto statsAfter = TaskFrameAllocator::GetStats();
+        co_return statsAfter.hits + statsAfter.misses >= statsBefore.hits + statsBefore.misses + 100;
+      }());
+
+      // freed frames are reused by the next allocations of the same size class
+      AddTest([]() -> Task<bool>
+      {
+        bool ok = true;
+        // fresh thread, so its freelists are not affected by other tests
+        std::thread([&]()
+        {
+          size_t const n = 8;
+          size_t const size = 200;
+          void* frames[n];
+          for(size_t i = 0; i < n; ++i)
+            frames[i] = TaskFrameAllocator::Allocate(size);
+          for(size_t i = 0; i < n; ++i)
+            TaskFrameAllocator::Deallocate(frames[i], size);
+          auto statsBefore = TaskFrameAllocator::GetStats();
+          void* reusedFrames[n];
+          for(size_t i = 0; i < n; ++i)
+          {
+            reusedFrames[i] = TaskFrameAllocator::Allocate(size + 1);
+            ok = ok && std::find(frames, frames + n, reusedFrames[i]) != frames + n;
+          }
+          auto statsAfter = TaskFrameAllocator::GetStats();
+          for(size_t i = 0; i < n; ++i)
+            TaskFrameAllocator::Deallocate(reusedFrames[i], size + 1);
+          ok = ok && statsAfter.hits >= statsBefore.hits + n;
+        }).join();
+        co_return ok;
+      }());
+    }
+
+    // executors
+    {
+      AddTest([]() -> Task<bool>
+      {
+        auto executor = std::make_shared<TaskThreadExecutor>();
+        std::jthread thread([executor](std::stop_token stopToken)
+        {
+          while(!stopToken.stop_requested())
+          {
+            executor->Run();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          }
+        });
+        std::thread::id const threadId = thread.get_id();
+
+        co_await ResumeOn(*executor);
+        bool ok = std::this_thread::get_id() == threadId;
+        // continuation returns to the executor
+        co_await []() -> Task<void>
+        {
+          co_await SleepFor(std::chrono::milliseconds(1));
+        }();
+        ok = ok && std::this_thread::get_id() == threadId;
+        co_await ResumeOn(TaskEngine::GetInstance());
+        co_return ok && std::this_thread::get_id() != threadId;
+      }());
+    }
+
+    // combinators
+    {
+      AddTest([]() -> Task<bool>
+      {
+        auto [a, b, c] = co_await WhenAll(
+          []() -> Task<uint32_t> { co_return 1; }(),
+          []() -> Task<std::string> { co_return "abc"; }(),
+          []() -> Task<void> { co_return; }()
+        );
+        std::vector<Task<uint64_t>> tasks;
+        for(uint64_t i = 0; i < 100; ++i)
+          tasks.push_back([](uint64_t i) -> Task<uint64_t>
+          {
+            co_return i * i;
+          }(i));
+        std::vector<uint64_t> results = co_await WhenAll(tasks);
+        uint64_t sum = 0;
+        for(size_t i = 0; i < results.size(); ++i)
+          sum += results[i];
+        co_return a == 1 && b == "abc" && sum == 328350;
+      }());
+
+      AddTest([]() -> Task<bool>
+      {
+        auto slowTask = []() -> Task<uint32_t>
+        {
+          co_await SleepFor(std::chrono::milliseconds(100));
+          co_return 1;
+        }();
+        auto fastTask = []() -> Task<void>
+        {
+          co_await SleepFor(std::chrono::milliseconds(1));
+        }();
+        size_t index = co_await WhenAny(slowTask, fastTask);
+        co_return index == 1 && co_await slowTask == 1;
+      }());
+    }
+
+    // parallel algorithms
+    {
+      AddTest([]() -> Task<bool>
+      {
+        size_t const n = 10000;
+        std::vector<uint64_t> values(n);
+        // mutable function is allowed
+        co_await ParallelFor(0, n, 0, [&](size_t i) mutable
+        {
+          values[i] = i;
+        });
+        std::vector<uint64_t> squares(n);
+        co_await ParallelTransform(values, squares, 100, [](uint64_t value)
+        {
+          return value * value;
+        });
+        uint64_t sum = co_await ParallelReduce(0, n, 10, uint64_t(0), [&](size_t i)
+        {
+          return squares[i];
+        }, [](uint64_t a, uint64_t b)
+        {
+          return a + b;
+        });
+        co_return sum == (n - 1) * n * (2 * n - 1) / 6;
+      }());
+
+      // reduction preserves order of indices
+      AddTest([]() -> Task<bool>
+      {
+        size_t const n = 1000;
+        std::string expected;
+        for(size_t i = 0; i < n; ++i)
+          expected += (char)('a' + i % 26);
+        std::string result = co_await ParallelReduce(0, n, 7, std::string(), [](size_t i)
+        {
+          return std::string(1, (char)('a' + i % 26));
+        }, [](std::string a, std::string const& b)
+        {
+          return std::move(a) + b;
+        });
+        co_return result == expected;
+      }());
+
+      // transform checks sizes
+      AddTest([]() -> Task<bool>
+      {
+        std::vector<uint32_t> input(10);
+        std::vector<uint32_t> output(9);
+        try
+        {
+          co_await ParallelTransform(input, output, 0, [](uint32_t value)
+          {
+            return value;
+          });
+        }
+        catch(Exception const&)
+        {
+          co_return true;
+        }
+        co_return false;
+      }());
+    }
+
+    // worker parking
+    {
+      AddTest([]() -> Task<bool>
+      {
+        TaskEngine& engine = TaskEngine::GetInstance();
+        // park immediately
+        engine.SetParkingConfig({ .spinCount = 0, .yieldCount = 0 });
+        bool ok = engine.GetParkingConfig().spinCount == 0;
+
+        // resumes coroutine from separate non-worker thread, after workers had time to park
+        struct QueueFromThread
+        {
+          bool await_ready() const
+          {
+            return false;
+          }
+          void await_suspend(std::coroutine_handle<> coroutine)
+          {
+            thread = std::jthread([coroutine]()
+            {
+              std::this_thread::sleep_for(std::chrono::milliseconds(2));
+              TaskEngine::GetInstance().Queue(coroutine, TaskPriority::Normal);
+            });
+          }
+          void await_resume() const
+          {
+          }
+          std::jthread thread;
+        };
+
+        auto getStats = [&]()
+        {
+          std::pair<uint64_t, Time::Tick> wakeupsAndIdleTicks = {};
+          for(auto const& stats : engine.GetWorkerStats())
+          {
+            wakeupsAndIdleTicks.first += stats.wakeupsCount;
+            wakeupsAndIdleTicks.second += stats.idleTicks;
+          }
+          return wakeupsAndIdleTicks;
+        };
+        auto statsBefore = getStats();
+        bool woken = false;
+        // other tests may keep workers busy or switch instrumentation off, so try several times
+        for(size_t i = 0; i < 100 && !woken; ++i)
+        {
+          engine.SetInstrumentation(true);
+          co_await QueueFromThread{};
+          auto statsAfter = getStats();
+          woken = statsAfter.first > statsBefore.first && statsAfter.second > statsBefore.second;
+        }
+        // restore engine defaults
+        engine.SetInstrumentation(false);
+        engine.SetParkingConfig({});
+        co_return ok && woken;
+      }());
+    }
+
+    // task scratch arena
+    {
+      AddTest([]() -> Task<bool>
+      {
+        TaskScratchArena& arena = co_await GetTaskScratchArena();
+        std::vector<uint32_t, TaskScratchAllocator<uint32_t>> numbers{arena};
+        for(uint32_t i = 0; i < 100000; ++i)
+          numbers.push_back(i);
+        std::vector<std::string, TaskScratchAllocator<std::string>> strings{arena};
+        strings.push_back("scratch");
+        void* aligned = arena.Allocate(1, 64);
+        uint64_t sum = 0;
+        for(size_t i = 0; i < numbers.size(); ++i)
+          sum += numbers[i];
+        co_return sum == 99999ULL * 100000 / 2 && strings[0] == "scratch" && ((uintptr_t)aligned & 63) == 0 && &co_await GetTaskScratchArena() == &arena;
+      }());
+    }
+
+    // cancellation
+    {
+      AddTest([]() -> Task<bool>
+      {
+        CancellationSource source;
+        CancellationToken token = source.GetToken();
+
+        // cancellable waits: sleep, condition variable, pipe read
+        auto sleeping = [](CancellationToken token) -> Task<bool>
+        {
+          try
+          {
+            co_await SleepFor(std::chrono::seconds(100), token);
+          }
+          catch(CancelledException const&)
+          {
+            co_return true;
+          }
+          co_return false;
+        }(token);
+        ConditionVariable cv;
+        std::mutex mutex;
+        auto waiting = [](ConditionVariable& cv, std::mutex& mutex, CancellationToken token) -> Task<bool>
+        {
+          std::unique_lock lock{mutex};
+          try
+          {
+            for(;;)
+              co_await cv.Wait(lock, token);
+          }
+          catch(CancelledException const&)
+          {
+            co_return lock.owns_lock();
+          }
+        }(cv, mutex, token);
+        SuspendablePipe pipe(16, false);
+        auto reading = [](SuspendablePipe& pipe, CancellationToken token) -> Task<bool>
+        {
+          try
+          {
+            uint8_t buf[16];
+            co_await pipe.Read(Buffer(buf, sizeof(buf)), token);
+          }
+          catch(CancelledException const&)
+          {
+            co_return true;
+          }
+          co_return false;
+        }(pipe, token);
+
+        co_await SleepFor(std::chrono::milliseconds(10));
+        bool notCancelledYet = !sleeping.IsReady() && !waiting.IsReady() && !reading.IsReady() && !token.IsCancelled();
+        source.Cancel();
+        bool cancelled = co_await sleeping && co_await waiting && co_await reading;
+
+        // already cancelled token throws right away
+        bool thrown = false;
+        try
+        {
+          co_await SleepFor(std::chrono::seconds(100), token);
+        }
+        catch(CancelledException const&)
+        {
+          thrown = true;
+        }
+
+        // not cancelled waits work as usual
+        co_await SleepFor(std::chrono::milliseconds(1), CancellationSource().GetToken());
+
+        co_return notCancelledYet && cancelled && thrown;
+      }());
+    }
+
+    // blocking waits inside tasks help running other coroutines
+    {
+      AddTest([]() -> Task<bool>
+      {
+        // more waiting tasks than threads, so all workers may get blocked
+        uint32_t const n = (uint32_t)TaskEngine::GetInstance().GetThreadsCount() * 4 + 4;
+        std::vector<Task<uint32_t>> tasks;
+        for(uint32_t i = 0; i < n; ++i)
+          tasks.push_back([](uint32_t i) -> Task<uint32_t>
+          {
+            co_return [](uint32_t i) -> Task<uint32_t>
+            {
+              co_return i;
+            }(i).Get() + 1;
+          }(i));
+        uint32_t sum = 0;
+        for(uint32_t i = 0; i < n; ++i)
+          sum += co_await tasks[i];
+        co_return sum == n * (n + 1) / 2;
+      }());
+
+      // main thread is helping in Get() with normal priority while workers are parked;
+      // background coroutine resumed from timer thread must still get a worker
+      AddTest([]() -> Task<bool>
+      {
+        TaskEngine& engine = TaskEngine::GetInstance();
+        engine.SetParkingConfig({ .spinCount = 0, .yieldCount = 0 });
+        bool ok = co_await []() -> Task<bool>
+        {
+          co_await SwitchPriority(TaskPriority::Background);
+          for(size_t i = 0; i < 20; ++i)
+            co_await SleepFor(std::chrono::milliseconds(1));
+          co_return TaskEngine::GetCurrentPriority() == TaskPriority::Background;
+        }();
+        engine.SetParkingConfig({});
+        co_return ok;
+      }());
+    }
+
+    // blocking pool
+    {
+      AddTest([]() -> Task<bool>
+      {
+        TaskBlockingPool& pool = TaskBlockingPool::GetInstance();
+        pool.ResetStats();
+        // blocking calls run in parallel, not limited by engine threads
+        size_t const n = 16;
+        std::vector<Task<uint32_t>> tasks;
+        for(uint32_t i = 0; i < n; ++i)
+          tasks.push_back([](uint32_t i) -> Task<uint32_t>
+          {
+            co_return co_await RunBlocking([i]()
+            {
+              std::this_thread::sleep_for(std::chrono::milliseconds(10));
+              return i * i;
+            });
+          }(i));
+        uint32_t sum = 0;
+        for(size_t i = 0; i < n; ++i)
+          sum += co_await tasks[i];
+        bool thrown = false;
+        try
+        {
+          co_await RunBlocking([]()
+          {
+            throw Exception("blocking call failed");
+          });
+        }
+        catch(Exception const&)
+        {
+          thrown = true;
+        }
+        TaskBlockingPoolStats stats = pool.GetStats();
+        co_return sum == (n - 1) * n * (2 * n - 1) / 6 && thrown && stats.jobsCount >= n + 1 && stats.peakThreadsCount > 1 && stats.peakThreadsCount <= pool.GetMaxThreadsCount();
+      }());
+    }
+
+#if defined(COIL_PLATFORM_POSIX)
+    // file I/O
+    {
+      AddTest([]() -> Task<bool>
+      {
+        std::FILE* file = std::tmpfile();
+        int fd = fileno(file);
+        char const data[] = "0123456789";
+        int64_t written = co_await TaskIo::Write(fd, 5, data, 10);
+        char buf[16] = {};
+        int64_t read = co_await TaskIo::Read(fd, 7, buf, sizeof(buf));
+        // batch of reads
+        char bytes[3] = {};
+        iovec iovecs[3];
+        TaskIoOperation operations[3];
+        for(size_t i = 0; i < 3; ++i)
+        {
+          iovecs[i] = { .iov_base = bytes + i, .iov_len = 1 };
+          operations[i].fd = fd;
+          operations[i].offset = 5 + i * 3;
+          operations[i].iovecs = iovecs + i;
+          operations[i].iovecsCount = 1;
+        }
+        co_await TaskIo::SubmitBatch(operations);
+        std::fclose(file);
+        co_return written == 10 && read == 8 && std::string_view(buf, 8) == "23456789" && std::string_view(bytes, 3) == "036";
+      }());
+    }
+#endif
+
+#if defined(COIL_PLATFORM_LINUX)
+    // descriptor readiness
+    {
+      AddTest([]() -> Task<bool>
+      {
+        int fds[2];
+        if(::pipe(fds) != 0) co_return false;
+        uint32_t writable = co_await TaskReactor::WaitWritable(fds[1]);
+        auto reading = [](int fd) -> Task<uint32_t>
+        {
+          co_return co_await TaskReactor::WaitReadable(fd);
+        }(fds[0]);
+        co_await SleepFor(std::chrono::milliseconds(10));
+        char c = 'x';
+        bool written = ::write(fds[1], &c, 1) == 1;
+        uint32_t readable = co_await reading;
+        ::close(fds[1]);
+        // closed write end is reported as error
+        uint32_t closed = co_await TaskReactor::WaitReadable(fds[0]);
+        ::close(fds[0]);
+        co_return writable == TaskReactor::Writable && written && readable == TaskReactor::Readable && (closed & TaskReactor::Error);
+      }());
+    }
+#endif
+
+    // instrumentation
+    {
+      AddTest([]() -> Task<bool>
+      {
+        TaskEngine& engine = TaskEngine::GetInstance();
+        engine.SetInstrumentation(true);
+        for(size_t i = 0; i < 100; ++i)
+          co_await []() -> Task<void>
+          {
+            co_return;
+          }();
+        engine.SetInstrumentation(false);
+        auto stats = engine.GetWorkerStats();
+        uint64_t resumedCount = 0;
+        for(size_t i = 0; i < stats.size(); ++i)
+          resumedCount += stats[i].resumedCount;
+        std::string trace = engine.ExportChromeTrace();
+        co_return resumedCount > 0 && trace.starts_with("{\"traceEvents\":[") && trace.ends_with("]}");
+      }());
+    }
+
     // semaphores
     {
       // n tasks, each acquires and releases semaphore m times
@@ -177,6 +776,169 @@ public:
       }(std::move(tasks)));
     }
 
+    // async mutexes
+    {
+      AddTest([]() -> Task<bool>
+      {
+        size_t const n = 100;
+        size_t const m = 100;
+        struct State
+        {
+          AsyncMutex mutex;
+          AsyncSharedMutex sharedMutex;
+          // guarded by mutex
+          size_t counter = 0;
+          // guarded by shared mutex, always equal
+          size_t a = 0, b = 0;
+        };
+        auto state = std::make_shared<State>();
+        std::vector<Task<bool>> tasks;
+        for(size_t i = 0; i < n; ++i)
+          tasks.push_back([](std::shared_ptr<State> state, size_t i) -> Task<bool>
+          {
+            bool ok = true;
+            for(size_t j = 0; j < m; ++j)
+            {
+              {
+                auto guard = co_await state->mutex.ScopedLock();
+                size_t counter = state->counter;
+                // suspend while holding the lock
+                co_await []() -> Task<void> { co_return; }();
+                state->counter = counter + 1;
+              }
+              if(i % 4 == 0)
+              {
+                co_await state->sharedMutex.Lock();
+                ++state->a;
+                co_await []() -> Task<void> { co_return; }();
+                ++state->b;
+                state->sharedMutex.Unlock();
+              }
+              else
+              {
+                auto guard = co_await state->sharedMutex.ScopedLockShared();
+                ok = ok && state->a == state->b;
+              }
+            }
+            co_return ok;
+          }(state, i));
+        bool ok = true;
+        for(size_t i = 0; i < tasks.size(); ++i)
+          ok = co_await tasks[i] && ok;
+        co_return ok && state->counter == n * m && state->a == n / 4 * m;
+      }());
+    }
+
+    // channels
+    {
+      // n senders send m values each through small channel
+      AddTest([]() -> Task<bool>
+      {
+        size_t const n = 10;
+        size_t const m = 1000;
+        auto channel = std::make_shared<Channel<uint64_t>>(4);
+        std::vector<Task<void>> senders;
+        for(size_t i = 0; i < n; ++i)
+          senders.push_back([](std::shared_ptr<Channel<uint64_t>> channel) -> Task<void>
+          {
+            for(uint64_t j = 0; j < m; ++j)
+              co_await channel->Send(j);
+          }(channel));
+        auto receiver = [](std::shared_ptr<Channel<uint64_t>> channel) -> Task<uint64_t>
+        {
+          uint64_t sum = 0;
+          uint64_t values[16];
+          while(size_t count = co_await channel->ReceiveMany(values))
+            for(size_t i = 0; i < count; ++i)
+              sum += values[i];
+          co_return sum;
+        };
+        Task<uint64_t> receiver1 = receiver(channel);
+        Task<uint64_t> receiver2 = receiver(channel);
+        co_await WhenAll(senders);
+        channel->Close();
+        uint64_t sum = co_await receiver1 + co_await receiver2;
+        co_return sum == n * (m - 1) * m / 2 && !co_await channel->Send(0);
+      }());
+
+      // capacity is rounded up
+      AddTest([]() -> Task<bool>
+      {
+        Channel<uint32_t> channel(3);
+        bool ok = channel.GetCapacity() == 4 && Channel<uint32_t>(0).GetCapacity() == 2;
+        for(uint32_t i = 0; i < 5; ++i)
+          ok = ok && channel.TrySend(i) == (i < 4);
+        co_return ok;
+      }());
+    }
+
+    // async generators
+    {
+      struct Test
+      {
+        static AsyncGenerator<uint32_t> Numbers(uint32_t n, uint32_t& produced)
+        {
+          for(uint32_t i = 0; i < n; ++i)
+          {
+            // switch threads in the middle
+            co_await SleepFor(std::chrono::milliseconds(i % 10 == 0 ? 1 : 0));
+            ++produced;
+            co_yield i;
+          }
+        }
+
+        static AsyncGenerator<uint64_t> Squares(AsyncGenerator<uint32_t> numbers)
+        {
+          for(;;)
+          {
+            std::optional<uint32_t> value = co_await numbers.Next();
+            if(!value.has_value()) break;
+            co_yield (uint64_t)value.value() * value.value();
+          }
+        }
+
+        static AsyncGenerator<uint32_t> Throwing()
+        {
+          co_yield 1;
+          throw Exception("generator failed");
+        }
+      };
+
+      AddTest([]() -> Task<bool>
+      {
+        uint32_t const n = 100;
+        uint32_t produced = 0;
+        uint32_t consumed = 0;
+        uint64_t sum = 0;
+        bool ahead = false;
+        co_await ForEach(Test::Squares(Test::Numbers(n, produced)), [&](uint64_t value)
+        {
+          // producer must not run ahead of consumer
+          ahead = ahead || produced != consumed + 1;
+          ++consumed;
+          sum += value;
+        });
+        co_return !ahead && consumed == n && sum == (uint64_t)(n - 1) * n * (2 * n - 1) / 6;
+      }());
+
+      AddTest([]() -> Task<bool>
+      {
+        AsyncGenerator<uint32_t> generator = Test::Throwing();
+        std::optional<uint32_t> first = co_await generator.Next();
+        bool thrown = false;
+        try
+        {
+          co_await generator.Next();
+        }
+        catch(Exception const&)
+        {
+          thrown = true;
+        }
+        std::optional<uint32_t> last = co_await generator.Next();
+        co_return first == 1 && thrown && !last.has_value();
+      }());
+    }
+
     // suspendable pipe
     {
       struct Test
@@ -234,6 +996,86 @@ public:
       AddTest(Test::Run(0x10000, 1000));
       AddTest(Test::Run(0x10000, 100000));
     }
+
+    // suspendable pipe with zero-copy spans
+    {
+      AddTest([]() -> Task<bool>
+      {
+        size_t const size = 0x10000;
+        SuspendablePipe pipe(100, false);
+
+        Task<void> writeTask = [](SuspendablePipe& pipe, size_t size) -> Task<void>
+        {
+          std::mt19937 rnd{456};
+          size_t writtenSize = 0;
+          while(writtenSize < size)
+          {
+            Buffer span = pipe.AcquireWriteSpan(std::min(size - writtenSize, rnd() % 100 + 1));
+            if(!span.size)
+            {
+              co_await pipe.WaitForWrite(1);
+              continue;
+            }
+            for(size_t i = 0; i < span.size; ++i)
+              ((uint8_t*)span.data)[i] = (uint8_t)((writtenSize + i) % 251);
+            pipe.CommitWrite(span.size);
+            writtenSize += span.size;
+          }
+          pipe.TryWrite({});
+        }(pipe, size);
+
+        size_t readSize = 0;
+        bool ok = true;
+        for(;;)
+        {
+          std::optional<Buffer> span = pipe.AcquireReadSpan();
+          if(!span.has_value()) break;
+          if(!span->size)
+          {
+            co_await pipe.WaitForRead();
+            continue;
+          }
+          // consume only part sometimes
+          size_t consumed = std::max<size_t>(span->size / 2, 1);
+          for(size_t i = 0; i < consumed; ++i)
+            ok = ok && ((uint8_t const*)span->data)[i] == (uint8_t)((readSize + i) % 251);
+          pipe.CommitRead(consumed);
+          readSize += consumed;
+        }
+
+        co_await writeTask;
+        co_return ok && readSize == size;
+      }());
+
+      // commits bigger than acquired spans are rejected
+      AddTest([]() -> Task<bool>
+      {
+        SuspendablePipe pipe(16, false);
+        bool ok = true;
+        Buffer writeSpan = pipe.AcquireWriteSpan(8);
+        try
+        {
+          pipe.CommitWrite(17);
+          ok = false;
+        }
+        catch(Exception const&)
+        {
+        }
+        pipe.CommitWrite(writeSpan.size);
+        std::optional<Buffer> readSpan = pipe.AcquireReadSpan();
+        ok = ok && readSpan.has_value() && readSpan->size == 8;
+        try
+        {
+          pipe.CommitRead(9);
+          ok = false;
+        }
+        catch(Exception const&)
+        {
+        }
+        pipe.CommitRead(readSpan->size);
+        co_return ok && pipe.AcquireReadSpan()->size == 0;
+      }());
+    }
   }
 
   ivec2 Run()